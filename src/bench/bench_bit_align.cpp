@@ -0,0 +1,151 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+// Microbenchmark for the Ximea 10 -> 16 bit MSB alignment
+//   bench_bit_align [width height frames]
+//
+// Every allocation made by the process is counted, the run fails if a kernel allocates per frame.
+
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <new>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "bit_align.hpp"
+
+
+static std::atomic<uint64_t> allocations{0};
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size){
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size){
+    allocations++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size){
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size){
+    allocations++;
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+}
+
+
+
+struct Result {
+    double ms_per_frame;
+    double allocs_per_frame;
+};
+
+template<typename F>
+static Result measure(int frames, size_t bytes, F &&body){
+    body(); // Warm up, first touch of the output buffers
+
+    uint64_t allocs_before = allocations;
+    auto start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < frames; i++){
+        body();
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    uint64_t allocs = allocations - allocs_before;
+
+    double ms = std::chrono::duration<double, std::milli>(end - start).count() / frames;
+    printf("  %8.3f ms/frame  %8.2f GB/s  %6.2f allocations/frame\n",
+        ms, bytes / (ms * 1e6), (double)allocs / frames);
+
+    return {ms, (double)allocs / frames};
+}
+
+
+
+int main(int argc, char *argv[]) {
+    int width = 2048;
+    int height = 1536;
+    int frames = 200;
+
+    if(argc == 4){
+        width = atoi(argv[1]);
+        height = atoi(argv[2]);
+        frames = atoi(argv[3]);
+    }
+
+    size_t n = (size_t)width * height;
+    printf("%dx%d, %d frames\n", width, height, frames);
+
+    cv::Mat raw(height, width, CV_16UC1);
+    cv::Mat out(height, width, CV_16UC1);
+    for(size_t i = 0; i < n; i++){
+        ((uint16_t*)raw.data)[i] = i & 0x3ff;
+    }
+
+    bool failed = false;
+
+    // What Ximea::run() used to do
+    printf("opencv: shifted = raw * 64; preview = shifted.clone()\n");
+    measure(frames, n * 2, [&]() {
+        cv::Mat shifted = raw * (1 << 6);
+        cv::Mat preview = shifted.clone();
+    });
+
+    for(const ShiftKernel &kernel : available_shift_kernels()){
+        printf("%s: into preallocated buffer%s\n", kernel.name,
+            kernel.fn == best_shift_kernel().fn ? " (selected)" : "");
+        Result r = measure(frames, n * 2, [&]() {
+            kernel.fn((const uint16_t*)raw.data, (uint16_t*)out.data, n, XIMEA_MSB_SHIFT);
+        });
+
+        for(size_t i = 0; i < n; i++){
+            if(((uint16_t*)out.data)[i] != (uint16_t)(((uint16_t*)raw.data)[i] << XIMEA_MSB_SHIFT)){
+                printf("  wrong result at pixel %zu\n", i);
+                failed = true;
+                break;
+            }
+        }
+
+        printf("%s: in place\n", kernel.name);
+        Result r_inplace = measure(frames, n * 2, [&]() {
+            kernel.fn((const uint16_t*)out.data, (uint16_t*)out.data, n, 0);
+        });
+
+        if(r.allocs_per_frame > 0 || r_inplace.allocs_per_frame > 0){
+            printf("  %s allocates in the frame loop\n", kernel.name);
+            failed = true;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+// Microbenchmark for the CD event hand-off
+//   bench_event_queue [rate_mev_s events_per_buffer seconds]
+//
+// Pushes synthetic CD buffers at the given event rate through an EventQueue, the way the Prophesee
+// callback does, while a consumer thread accumulates them into a frame. Reports the push latency.
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "event_queue.hpp"
+
+
+// Same layout as Metavision::EventCD
+struct Event {
+    uint16_t x;
+    uint16_t y;
+    int16_t p;
+    int64_t t;
+};
+
+
+
+int main(int argc, char *argv[]) {
+    double rate = 100;
+    int events_per_buffer = 2000;
+    double seconds = 5;
+
+    if(argc == 4){
+        rate = atof(argv[1]);
+        events_per_buffer = atoi(argv[2]);
+        seconds = atof(argv[3]);
+    }
+
+    const int width = 1280, height = 720;
+    std::vector<Event> buffer(events_per_buffer);
+    for(int i = 0; i < events_per_buffer; i++){
+        buffer[i].x = (i * 7919) % width;
+        buffer[i].y = (i * 104729) % height;
+        buffer[i].p = i & 1;
+    }
+
+    EventQueue<Event> queue(256, events_per_buffer);
+    LatencyStats latency;
+
+    std::atomic<bool> consuming{true};
+    uint64_t consumed = 0;
+    std::thread consumer([&]() {
+        std::vector<uint32_t> frame(width * height);
+        while(consuming){
+            queue.wait(std::chrono::milliseconds(100));
+            while(const std::vector<Event> *chunk = queue.front()){
+                for(const Event &ev : *chunk){
+                    frame[ev.y * width + ev.x] += ev.p ? 1 : -1;
+                }
+                consumed += chunk->size();
+                queue.pop();
+            }
+        }
+    });
+
+    printf("%.0f Mev/s in buffers of %d events for %.0f s\n", rate, events_per_buffer, seconds);
+
+    // Buffers are paced like the SDK delivers them
+    auto period = std::chrono::duration<double>(events_per_buffer / (rate * 1e6));
+    auto start = std::chrono::steady_clock::now();
+    auto next = start;
+    int64_t t = 0;
+    uint64_t pushed = 0;
+
+    while(std::chrono::steady_clock::now() - start < std::chrono::duration<double>(seconds)){
+        for(Event &ev : buffer){
+            ev.t = t++;
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        queue.push(buffer.data(), buffer.data() + buffer.size());
+        latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+        pushed += buffer.size();
+
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+        while(std::chrono::steady_clock::now() < next){
+        }
+    }
+
+    consuming = false;
+    queue.wake();
+    consumer.join();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LatencyStats::Summary s = latency.summary();
+    printf("  pushed %.1f Mev/s, consumed %.1f Mev/s\n", pushed / elapsed / 1e6, consumed / elapsed / 1e6);
+    printf("  push %.2f us mean, %.2f us p99, %.2f us max over %lu buffers\n",
+           s.mean_us, s.p99_us, s.max_us, (unsigned long)s.count);
+    printf("  dropped %lu buffers (%lu events)\n", (unsigned long)queue.dropped(), (unsigned long)queue.dropped_event_count());
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+// Microbenchmark for the Ximea preview
+//   bench_preview [width height frames]
+//
+// Compares the fused GBRG -> BGR8 preview kernels with the cvtColor + convertTo path UI::run() used.
+
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "preview.hpp"
+
+
+
+template<typename F>
+static double measure(int frames, F &&body){
+    body(); // Warm up, first touch of the output buffers
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < frames; i++){
+        body();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double ms = std::chrono::duration<double, std::milli>(end - start).count() / frames;
+    printf("  %8.3f ms/frame\n", ms);
+    return ms;
+}
+
+
+
+int main(int argc, char *argv[]) {
+    int width = 2464;
+    int height = 2056;
+    int frames = 100;
+
+    if(argc == 4){
+        width = atoi(argv[1]);
+        height = atoi(argv[2]);
+        frames = atoi(argv[3]);
+    }
+
+    printf("%dx%d, %d frames\n", width, height, frames);
+
+    // MSB aligned 10 bit mosaic, as published by Ximea::run()
+    cv::Mat raw(height, width, CV_16UC1);
+    for(size_t i = 0; i < raw.total(); i++){
+        ((uint16_t*)raw.data)[i] = ((i * 2654435761u) >> 7 & 0x3ff) << 6;
+    }
+
+    printf("opencv: cvtColor(BayerGBRG2BGR) + convertTo(CV_8UC3, 1/256)\n");
+    double baseline = measure(frames, [&]() {
+        cv::Mat bgr16, bgr8;
+        cv::cvtColor(raw, bgr16, cv::COLOR_BayerGBRG2BGR);
+        bgr16.convertTo(bgr8, CV_8UC3, 1/256.0);
+    });
+
+    for(int downscale : {1, 2, 4}){
+        cv::Mat out(preview_size(height, downscale), preview_size(width, downscale), CV_8UC3);
+
+        for(const PreviewKernel &kernel : available_preview_kernels()){
+            printf("%s, downscale %d (%dx%d)%s\n", kernel.name, downscale, out.cols, out.rows,
+                kernel.row == best_preview_kernel().row ? " (selected)" : "");
+            double ms = measure(frames, [&]() {
+                preview_gbrg((const uint16_t*)raw.data, raw.step, width, height, out.data, out.step, downscale, 8, kernel);
+            });
+            printf("  %8.1fx faster than opencv\n", baseline / ms);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+// Microbenchmark for the live event representations
+//   bench_representations [width height rate_mev_s threads]
+//
+// Feeds synthetic CD batches to a RepresentationEngine with one representation enabled at a time,
+// then all of them, and reports the sustained event rate. Publishing runs at 30 Hz of event time
+// with a consumer attached, like a live viewer.
+
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "representations.hpp"
+
+
+// Same layout as Metavision::EventCD
+struct Event {
+    uint16_t x;
+    uint16_t y;
+    int16_t p;
+    int64_t t;
+};
+
+
+
+static void run(const char *name, Representation_config config, int width, int height,
+                const std::vector<std::vector<Event>> &batches){
+    RepresentationEngine engine(width, height, config);
+    engine.attach();
+
+    Representations snapshot;
+    int published = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(const auto &batch : batches){
+        engine.process(batch.data(), batch.data() + batch.size());
+        published += engine.read(snapshot);
+    }
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double event_s = (batches.back().back().t - batches.front().front().t) / 1e6;
+    printf("  %-14s %2d threads  %7.1f Mev/s  (%.1fx real time, %d snapshots)\n", name, config.threads,
+           engine.events() / s / 1e6, event_s / s, published);
+}
+
+
+
+int main(int argc, char *argv[]) {
+    int width = 1280;
+    int height = 720;
+    double rate = 50;
+    int threads = 4;
+
+    if(argc == 5){
+        width = atoi(argv[1]);
+        height = atoi(argv[2]);
+        rate = atof(argv[3]);
+        threads = atoi(argv[4]);
+    }
+
+    // Two seconds of events in SDK sized buffers
+    const int batch_events = 4096;
+    size_t total = rate * 1e6 * 2;
+    std::vector<std::vector<Event>> batches;
+    std::mt19937 rng(42);
+    double t = 0;
+    for(size_t n = 0; n < total; n += batch_events){
+        std::vector<Event> batch(batch_events);
+        for(Event &ev : batch){
+            ev.x = rng() % width;
+            ev.y = rng() % height;
+            ev.p = rng() & 1;
+            ev.t = (int64_t)t;
+            t += 1 / rate;
+        }
+        batches.push_back(std::move(batch));
+    }
+    printf("%dx%d, %zu events at %.0f Mev/s\n", width, height, total, rate);
+
+    for(int n : {1, threads}){
+        Representation_config config;
+        config.threads = n;
+
+        Representation_config only = config;
+        only.histogram = only.voxel = false;
+        run("time surface", only, width, height, batches);
+
+        only = config;
+        only.time_surface = only.voxel = false;
+        run("histogram", only, width, height, batches);
+
+        only = config;
+        only.time_surface = only.histogram = false;
+        run("voxel grid", only, width, height, batches);
+
+        run("all", config, width, height, batches);
+
+        if(threads == 1){
+            break;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#include "bit_align.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BIT_ALIGN_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BIT_ALIGN_NEON
+#endif
+
+
+
+static void shift_scalar(const uint16_t *src, uint16_t *dst, size_t n, int shift){
+    for(size_t i = 0; i < n; i++){
+        dst[i] = (uint16_t)(src[i] << shift);
+    }
+}
+
+
+#ifdef BIT_ALIGN_X86
+
+__attribute__((target("sse2")))
+static void shift_sse2(const uint16_t *src, uint16_t *dst, size_t n, int shift){
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for(; i + 8 <= n; i += 8){
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_sll_epi16(v, count));
+    }
+    shift_scalar(src + i, dst + i, n - i, shift);
+}
+
+__attribute__((target("avx2")))
+static void shift_avx2(const uint16_t *src, uint16_t *dst, size_t n, int shift){
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for(; i + 32 <= n; i += 32){
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 16));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_sll_epi16(a, count));
+        _mm256_storeu_si256((__m256i*)(dst + i + 16), _mm256_sll_epi16(b, count));
+    }
+    for(; i + 16 <= n; i += 16){
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_sll_epi16(a, count));
+    }
+    shift_scalar(src + i, dst + i, n - i, shift);
+}
+
+#endif
+
+
+#ifdef BIT_ALIGN_NEON
+
+static void shift_neon(const uint16_t *src, uint16_t *dst, size_t n, int shift){
+    const int16x8_t count = vdupq_n_s16(shift);
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16){
+        uint16x8_t a = vld1q_u16(src + i);
+        uint16x8_t b = vld1q_u16(src + i + 8);
+        vst1q_u16(dst + i, vshlq_u16(a, count));
+        vst1q_u16(dst + i + 8, vshlq_u16(b, count));
+    }
+    shift_scalar(src + i, dst + i, n - i, shift);
+}
+
+#endif
+
+
+
+std::vector<ShiftKernel> available_shift_kernels(){
+    std::vector<ShiftKernel> kernels;
+    kernels.push_back({"scalar", shift_scalar});
+
+#ifdef BIT_ALIGN_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")){
+        kernels.push_back({"sse2", shift_sse2});
+    }
+    if(__builtin_cpu_supports("avx2")){
+        kernels.push_back({"avx2", shift_avx2});
+    }
+#endif
+
+#ifdef BIT_ALIGN_NEON
+    kernels.push_back({"neon", shift_neon});
+#endif
+
+    return kernels;
+}
+
+
+const ShiftKernel& best_shift_kernel(){
+    // Last entry is the widest one
+    static const ShiftKernel best = available_shift_kernels().back();
+    return best;
+}
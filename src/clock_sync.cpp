@@ -0,0 +1,424 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "clock_sync.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+
+// Frames waiting for their edges before the oldest is given up on
+static const size_t MAX_PENDING_FRAMES = 64;
+// Consecutive frames without an edge before the clock has to be acquired again
+static const int MAX_MISSES = 30;
+
+
+ClockSync::~ClockSync(){
+    end_session();
+}
+
+
+void ClockSync::start_session(const std::string &path){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!config.enabled){
+        return;
+    }
+
+    std::string table_path = path + "/ximea_event_time.bin";
+    table = fopen(table_path.c_str(), "wb");
+    if(!table){
+        std::cerr << "Cannot create " << table_path << std::endl;
+        return;
+    }
+    ClockTableHeader hdr;
+    memcpy(hdr.magic, CLOCK_TABLE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CLOCK_TABLE_VERSION;
+    hdr.record_size = sizeof(ClockTableRecord);
+    fwrite(&hdr, sizeof(hdr), 1, table);
+
+    frames.clear();
+    edges.clear();
+    pairs.clear();
+    fit = Model();
+    misses = 0;
+    matched = predicted = unlocked = 0;
+    session_path = path;
+
+    {
+        std::lock_guard<std::mutex> input_lock(input_mutex);
+        new_frames.clear();
+        new_triggers.clear();
+        accepting = true;
+        closing = false;
+    }
+    worker = std::thread(&ClockSync::run, this);
+}
+
+
+void ClockSync::end_session(){
+    {
+        std::lock_guard<std::mutex> input_lock(input_mutex);
+        accepting = false;
+        closing = true;
+    }
+    input_ready.notify_one();
+    if(worker.joinable()){
+        worker.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!table){
+        return;
+    }
+    resolve(true);
+    while(!frames.empty()){
+        write(frames.front(), 0, -1, -1);
+        frames.pop_front();
+    }
+    fclose(table);
+    table = nullptr;
+
+    printf("Clock sync: %llu frames matched, %llu predicted, lost lock %llu times, offset %.1f us, drift %.3f ppm, rms %.2f us\n",
+           (unsigned long long)matched, (unsigned long long)predicted, (unsigned long long)unlocked,
+           fit.offset_us, fit.drift * 1e6, fit.rms_us);
+
+    // The final model, for frames outside the table or other tools
+    std::string model_path = session_path + "/clock_sync.yaml";
+    FILE *f = fopen(model_path.c_str(), "w");
+    if(f){
+        fprintf(f, "# event_t = ximea_t + offset_us + drift * (ximea_t - x0_us)\n");
+        fprintf(f, "locked: %s\noffset_us: %.3f\nx0_us: %.0f\ndrift: %.12f\nrms_us: %.3f\npairs: %zu\n",
+                fit.locked ? "true" : "false", fit.offset_us, fit.x0, fit.drift, fit.rms_us, fit.pairs);
+        fprintf(f, "matched: %llu\npredicted: %llu\nunlocked: %llu\n",
+                (unsigned long long)matched, (unsigned long long)predicted, (unsigned long long)unlocked);
+        fclose(f);
+    }
+}
+
+
+ClockSync::Model ClockSync::model(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return fit;
+}
+
+
+// Called from the Ximea capture loop, only queues the frame
+void ClockSync::add_frame(int32_t frame_id, int64_t ximea_ts_us, uint32_t exposure_us, int64_t host_us){
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(input_mutex);
+        if(!accepting){
+            return;
+        }
+        wake = new_frames.empty() && new_triggers.empty();
+        new_frames.push_back(Frame{frame_id, ximea_ts_us, exposure_us, host_us});
+    }
+    if(wake){
+        input_ready.notify_one();
+    }
+}
+
+
+// Called from the SDK's trigger callback, only queues the edge
+void ClockSync::add_trigger(int64_t t_us, int polarity, int64_t host_us){
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(input_mutex);
+        if(!accepting){
+            return;
+        }
+        wake = new_frames.empty() && new_triggers.empty();
+        new_triggers.push_back(Trigger{t_us, polarity, host_us});
+    }
+    if(wake){
+        input_ready.notify_one();
+    }
+}
+
+
+void ClockSync::run(){
+    std::vector<Frame> arrived;
+    std::vector<Trigger> triggers;
+
+    std::unique_lock<std::mutex> input_lock(input_mutex);
+    while(true){
+        input_ready.wait(input_lock, [this]() { return closing || !new_frames.empty() || !new_triggers.empty(); });
+        arrived.swap(new_frames);
+        triggers.swap(new_triggers);
+        bool done = closing;
+        input_lock.unlock();
+
+        process(triggers, arrived);
+        arrived.clear();
+        triggers.clear();
+
+        if(done){
+            return;
+        }
+        input_lock.lock();
+    }
+}
+
+
+// Edges first, a frame usually arrives after the edges of its exposure
+void ClockSync::process(const std::vector<Trigger> &triggers, const std::vector<Frame> &arrived){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!table){
+        return;
+    }
+    for(const Trigger &trigger : triggers){
+        if(trigger.polarity == config.start_polarity){
+            edges.push_back(Edge{trigger.t, -1, trigger.host});
+        } else if(!edges.empty() && edges.back().end < 0){
+            edges.back().end = trigger.t;
+        }
+    }
+    frames.insert(frames.end(), arrived.begin(), arrived.end());
+
+    if(!fit.locked){
+        acquire();
+    }
+    resolve(false);
+}
+
+
+// Nearest edge start to t in [begin, end), end when there are none
+std::deque<ClockSync::Edge>::iterator ClockSync::nearest_edge(std::deque<Edge>::iterator begin, std::deque<Edge>::iterator end, double t){
+    auto it = std::lower_bound(begin, end, t, [](const Edge &e, double v) {
+        return e.start < v;
+    });
+    if(it == end){
+        return begin == end ? it : it - 1;
+    }
+    if(it != begin && t - (it - 1)->start < it->start - t){
+        return it - 1;
+    }
+    return it;
+}
+
+
+// Tries every edge as the start of the first pending frame, the clocks are assumed to run at the same
+// rate over the few frames involved. Only edges that had arrived with the last of those frames take
+// part, later ones would let a pairing shifted by whole frames match as well.
+void ClockSync::acquire(){
+    size_t n = config.acquire_frames;
+    auto available = frames.size() < n ? edges.begin() :
+        std::find_if(edges.begin(), edges.end(), [this, n](const Edge &e) { return e.host > frames[n - 1].host; });
+    if(frames.size() < n || (size_t)(available - edges.begin()) < n / 2){
+        // Nothing to lock on, the GPO may not be wired
+        while(frames.size() > MAX_PENDING_FRAMES){
+            write(frames.front(), 0, -1, -1);
+            frames.pop_front();
+        }
+        return;
+    }
+
+    const Frame &first = frames.front();
+    size_t best_matches = 0;
+    double best_exposure = 0, best_host = 0;
+    int64_t best_offset = 0;
+
+    for(auto candidate = edges.begin(); candidate != available; ++candidate){
+        int64_t offset = candidate->start - first.ts;
+        size_t matches = 0;
+        double exposure_error = 0;
+
+        for(size_t i = 0; i < n; i++){
+            auto edge = nearest_edge(edges.begin(), available, frames[i].ts + offset);
+            if(std::llabs(edge->start - (frames[i].ts + offset)) > config.tolerance_us){
+                continue;
+            }
+            matches++;
+            if(edge->end >= 0){
+                exposure_error += std::fabs((double)(edge->end - edge->start) - frames[i].exposure);
+            }
+        }
+        if(matches == 0){
+            continue;
+        }
+        exposure_error /= matches;
+
+        // The frame reaches the host after its exposure, the edge shortly after it started
+        double host_error = std::fabs((double)(first.host - first.exposure) - candidate->host);
+
+        bool better = matches > best_matches ||
+                      (matches == best_matches && exposure_error < best_exposure - config.tolerance_us / 10.0) ||
+                      (matches == best_matches && std::fabs(exposure_error - best_exposure) <= config.tolerance_us / 10.0 &&
+                       host_error < best_host);
+        if(better){
+            best_matches = matches;
+            best_exposure = exposure_error;
+            best_host = host_error;
+            best_offset = offset;
+        }
+    }
+
+    if(best_matches * 4 < n * 3){
+        while(frames.size() > MAX_PENDING_FRAMES){
+            write(frames.front(), 0, -1, -1);
+            frames.pop_front();
+        }
+        if(edges.size() > 4 * MAX_PENDING_FRAMES){
+            edges.erase(edges.begin(), edges.end() - MAX_PENDING_FRAMES);
+        }
+        return;
+    }
+
+    fit = Model();
+    fit.locked = true;
+    fit.x0 = first.ts;
+    fit.offset_us = best_offset;
+    pairs.clear();
+    misses = 0;
+}
+
+
+double ClockSync::predict(int64_t ximea_ts) const {
+    return ximea_ts + fit.offset_us + fit.drift * (ximea_ts - fit.x0);
+}
+
+
+// Least squares of (event - ximea) against ximea time over the last fit_pairs matches
+void ClockSync::refit(){
+    while(pairs.size() > (size_t)std::max(config.fit_pairs, 2)){
+        pairs.pop_front();
+    }
+    double x0 = pairs.front().first;
+    double su = 0, sv = 0, suu = 0, suv = 0;
+    for(const auto &p : pairs){
+        double u = p.first - x0;
+        double v = p.second - p.first;
+        su += u;
+        sv += v;
+        suu += u * u;
+        suv += u * v;
+    }
+    double n = pairs.size();
+    double det = n * suu - su * su;
+    double drift = det > 0 ? (n * suv - su * sv) / det : 0;
+    double offset = (sv - drift * su) / n;
+
+    double ss = 0;
+    for(const auto &p : pairs){
+        double r = (p.second - p.first) - (offset + drift * (p.first - x0));
+        ss += r * r;
+    }
+
+    fit.x0 = x0;
+    fit.offset_us = offset;
+    fit.drift = drift;
+    fit.rms_us = std::sqrt(ss / n);
+    fit.pairs = pairs.size();
+}
+
+
+// Matches pending frames in order while their edges can be decided on
+void ClockSync::resolve(bool flush){
+    while(fit.locked && !frames.empty()){
+        const Frame frame = frames.front();
+        double p = predict(frame.ts);
+        double scale = 1 + fit.drift;
+
+        // Edges too old for this or any later frame
+        while(!edges.empty() && edges.front().start < p - config.tolerance_us){
+            edges.pop_front();
+        }
+
+        auto edge = nearest_edge(edges.begin(), edges.end(), p);
+        bool found = edge != edges.end() && std::fabs(edge->start - p) <= config.tolerance_us;
+
+        if(found){
+            // The end edge follows at most one exposure later
+            if(edge->end < 0 && !flush && edge + 1 == edges.end() && frames.size() < MAX_PENDING_FRAMES){
+                return;
+            }
+            uint32_t flags = CLOCK_MATCHED;
+            int64_t end = edge->start + (int64_t)std::llround(frame.exposure * scale);
+            if(edge->end >= 0){
+                flags |= CLOCK_END_EDGE;
+                end = edge->end;
+            }
+            write(frame, flags, edge->start, end);
+            matched++;
+            misses = 0;
+
+            pairs.emplace_back(frame.ts, edge->start);
+            refit();
+            edges.erase(edges.begin(), edge + 1);
+        } else {
+            // Missing only once edges beyond the prediction arrived
+            bool later_edges = !edges.empty() && edges.back().start > p + config.tolerance_us;
+            if(!later_edges && !flush && frames.size() < MAX_PENDING_FRAMES){
+                return;
+            }
+            int64_t start = std::llround(p);
+            write(frame, CLOCK_PREDICTED, start, start + (int64_t)std::llround(frame.exposure * scale));
+            predicted++;
+
+            if(++misses >= MAX_MISSES){
+                fit.locked = false;
+                unlocked++;
+                frames.pop_front();
+                return;
+            }
+        }
+        frames.pop_front();
+    }
+}
+
+
+void ClockSync::write(const Frame &frame, uint32_t flags, int64_t start, int64_t end){
+    ClockTableRecord record;
+    record.frame_id = frame.frame_id;
+    record.flags = flags;
+    record.ximea_ts_us = frame.ts;
+    record.start_us = start;
+    record.end_us = end;
+    fwrite(&record, sizeof(record), 1, table);
+}
+
+
+
+void clock_table_to_csv(const std::string &bin_path, const std::string &csv_path){
+    FILE *in = fopen(bin_path.c_str(), "rb");
+    if(!in){
+        throw "Cannot open clock table";
+    }
+    ClockTableHeader hdr;
+    if(fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, CLOCK_TABLE_MAGIC, sizeof(hdr.magic)) != 0 ||
+       hdr.record_size != sizeof(ClockTableRecord)){
+        fclose(in);
+        throw "Not a clock table";
+    }
+
+    FILE *out = fopen(csv_path.c_str(), "w");
+    if(!out){
+        fclose(in);
+        throw "Cannot create clock table CSV";
+    }
+    fprintf(out, "frame_id,ximea_ts_us,start_us,end_us,flags\n");
+
+    ClockTableRecord record;
+    while(fread(&record, sizeof(record), 1, in) == 1){
+        fprintf(out, "%d,%lld,%lld,%lld,%u\n", record.frame_id, (long long)record.ximea_ts_us,
+                (long long)record.start_us, (long long)record.end_us, record.flags);
+    }
+    fclose(in);
+    if(fclose(out) != 0){
+        throw "Writing clock table CSV";
+    }
+}
@@ -0,0 +1,438 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "device_registry.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <set>
+#include <thread>
+
+
+DeviceType device_type_from_string(const std::string &s){
+    if(s == "ximea"){
+        return DeviceType::XIMEA;
+    } else if(s == "prophesee"){
+        return DeviceType::PROPHESEE;
+    }
+    std::cerr << "Unknown device type: " << s << std::endl;
+    throw "Unknown device type";
+}
+
+
+Device* DeviceEntry::device() const {
+    if(ximea){
+        return ximea.get();
+    }
+    return prophesee.get();
+}
+
+
+
+DeviceRegistry::DeviceRegistry(const Ximea_config &ximea_defaults, const Prophesee_config &right_defaults,
+                               const Prophesee_config &left_defaults) : ximea_defaults(ximea_defaults) {
+    prophesee_defaults["ev_right"] = right_defaults;
+    prophesee_defaults["ev_left"] = left_defaults;
+
+    Prophesee_config other = left_defaults;
+    other.serial.clear();
+    other.biases_file.clear();
+    other.roi.clear();
+    other.master = false;
+    prophesee_defaults[""] = other;
+}
+
+
+void DeviceRegistry::load(const std::string &config_file, const YAML::Node &config){
+    entries.clear();
+
+    if(config["session"]){
+        const YAML::Node &session = config["session"];
+        if(session["arm_timeout_ms"]){
+            session_config.arm_timeout_ms = session["arm_timeout_ms"].as<int>();
+        }
+        if(session["max_skew_us"]){
+            session_config.max_skew_us = session["max_skew_us"].as<int>();
+        }
+    }
+
+    if(!config["devices"]){
+        add("ximea", DeviceType::XIMEA, "ximea", config_file, config);
+        add("left", DeviceType::PROPHESEE, "ev_left", config_file, config);
+        add("right", DeviceType::PROPHESEE, "ev_right", config_file, config);
+        return;
+    }
+
+    for(const auto &node : config["devices"]){
+        if(!node["name"] || !node["type"]){
+            throw "Devices need a name and a type";
+        }
+        std::string name = node["name"].as<std::string>();
+        std::string section = node["section"] ? node["section"].as<std::string>() : name;
+        add(name, device_type_from_string(node["type"].as<std::string>()), section, config_file, config);
+    }
+    if(entries.empty()){
+        throw "No devices configured";
+    }
+}
+
+
+void DeviceRegistry::add(const std::string &name, DeviceType type, const std::string &section,
+                         const std::string &config_file, const YAML::Node &config){
+    for(const auto &entry : entries){
+        if(entry->name == name){
+            std::cerr << "Device " << name << " is listed twice" << std::endl;
+            throw "Duplicate device name";
+        }
+    }
+
+    std::unique_ptr<DeviceEntry> entry(new DeviceEntry());
+    entry->name = name;
+    entry->type = type;
+    entry->section = section;
+
+    if(type == DeviceType::XIMEA){
+        entry->ximea_config.reset(new Ximea_config(ximea_defaults));
+        if(config[section]){
+            set_ximea_config(*entry->ximea_config, config[section]);
+        }
+        entry->ximea_config->output_name = name;
+    } else {
+        auto defaults = prophesee_defaults.find(section);
+        if(defaults == prophesee_defaults.end()){
+            defaults = prophesee_defaults.find("");
+        }
+        entry->prophesee_config.reset(new Prophesee_config(defaults->second));
+
+        Prophesee_config &c = *entry->prophesee_config;
+        c.config_file = config_file;
+        c.config_section = section;
+        if(config[section]){
+            set_prophesee_config(c, config[section]);
+        }
+        c.output_name = name;
+    }
+
+    if(config[section] && config[section]["placement"]){
+        set_placement_config(entry->placement, config[section]["placement"]);
+    }
+
+    entries.push_back(std::move(entry));
+}
+
+
+void DeviceRegistry::create(){
+    device_list.clear();
+    for(auto &entry : entries){
+        if(entry->type == DeviceType::XIMEA){
+            entry->ximea.reset(new Ximea(*entry->ximea_config));
+        } else {
+            entry->prophesee.reset(new Prophesee(*entry->prophesee_config));
+        }
+        entry->device()->set_placement(entry->placement);
+        device_list.push_back(entry->device());
+    }
+}
+
+
+std::vector<Ximea_config*> DeviceRegistry::ximea_configs(){
+    std::vector<Ximea_config*> configs;
+    for(auto &entry : entries){
+        if(entry->ximea_config){
+            configs.push_back(entry->ximea_config.get());
+        }
+    }
+    return configs;
+}
+
+std::vector<Prophesee_config*> DeviceRegistry::prophesee_configs(){
+    std::vector<Prophesee_config*> configs;
+    for(auto &entry : entries){
+        if(entry->prophesee_config){
+            configs.push_back(entry->prophesee_config.get());
+        }
+    }
+    return configs;
+}
+
+
+DeviceEntry* DeviceRegistry::find(const std::string &name, DeviceType type){
+    for(auto &entry : entries){
+        if(entry->type == type && (entry->name == name || entry->section == name)){
+            return entry.get();
+        }
+    }
+    return nullptr;
+}
+
+Ximea* DeviceRegistry::find_ximea(const std::string &name){
+    DeviceEntry *entry = find(name, DeviceType::XIMEA);
+    return entry ? entry->ximea.get() : nullptr;
+}
+
+Prophesee* DeviceRegistry::find_prophesee(const std::string &name){
+    DeviceEntry *entry = find(name, DeviceType::PROPHESEE);
+    return entry ? entry->prophesee.get() : nullptr;
+}
+
+
+// Every device initializes on its own thread. Prophesee slaves have to stream before their master
+// starts, so the masters wait for the slaves' readiness instead of a fixed delay.
+void DeviceRegistry::start(){
+    std::vector<Device*> slaves;
+    for(auto &entry : entries){
+        if(entry->type == DeviceType::PROPHESEE && !entry->master()){
+            slaves.push_back(entry->device());
+        }
+    }
+    for(auto &entry : entries){
+        if(entry->master()){
+            entry->device()->start_after(slaves);
+        }
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> initializers;
+    std::vector<const char*> errors(entries.size(), nullptr);
+    for(size_t i = 0; i < entries.size(); i++){
+        initializers.emplace_back([this, i, &errors]() {
+            try {
+                entries[i]->device()->start();
+            } catch(const char* err) {
+                errors[i] = err;
+            }
+        });
+    }
+    for(auto &initializer : initializers){
+        initializer.join();
+    }
+    for(size_t i = 0; i < entries.size(); i++){
+        if(errors[i]){
+            std::cerr << "Device " << entries[i]->name << ": " << errors[i] << std::endl;
+            throw errors[i];
+        }
+    }
+
+    int64_t begin_us = std::chrono::duration_cast<std::chrono::microseconds>(begin.time_since_epoch()).count();
+    double slowest = 0;
+    for(auto &entry : entries){
+        Device *device = entry->device();
+        if(!device->wait_ready(std::chrono::seconds(10))){
+            printf("Device %s: init %.0f ms, not ready after 10 s\n", entry->name.c_str(), device->init_time_ms());
+            continue;
+        }
+        double ready_ms = (device->ready_time_us() - begin_us) / 1000.0;
+        slowest = std::max(slowest, ready_ms);
+        printf("Device %s: init %.0f ms, ready after %.0f ms\n", entry->name.c_str(), device->init_time_ms(), ready_ms);
+    }
+    printf("Devices ready in %.0f ms\n", slowest);
+}
+
+
+bool DeviceRegistry::start_recording(const fs::path &path){
+    session_path = path;
+    barrier.reset(entries.size());
+    for(auto &entry : entries){
+        entry->device()->arm(path, &barrier);
+    }
+
+    if(!barrier.wait_armed(std::chrono::milliseconds(session_config.arm_timeout_ms))){
+        printf("Session: %zu of %zu devices armed after %d ms, recording not started\n", barrier.armed(), entries.size(),
+               session_config.arm_timeout_ms);
+        for(auto &entry : entries){
+            entry->device()->stop_recording();
+        }
+        barrier.abort();
+        return false;
+    }
+    barrier.commit();
+
+    wait_for_marks(true);
+    report_skew(true);
+    return true;
+}
+
+
+void DeviceRegistry::stop_recording(){
+    for(auto &entry : entries){
+        entry->device()->stop_recording();
+    }
+
+    wait_for_marks(false);
+    report_skew(false);
+    write_session_sync();
+}
+
+
+// A device that has not marked within the arm timeout is reported as missing
+void DeviceRegistry::wait_for_marks(bool start){
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(session_config.arm_timeout_ms);
+    for(auto &entry : entries){
+        Device *device = entry->device();
+        // Devices that never started have nothing to stop
+        if(!start && device->capture_start() < 0){
+            continue;
+        }
+        while((start ? device->capture_start() : device->capture_end()) < 0 &&
+              std::chrono::steady_clock::now() < deadline){
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+
+void DeviceRegistry::report_skew(bool start){
+    int64_t first = -1, last = -1;
+    std::string line;
+    for(auto &entry : entries){
+        int64_t t = start ? entry->device()->capture_start() : entry->device()->capture_end();
+        if(t < 0){
+            line += " " + entry->name + " missing";
+            continue;
+        }
+        first = first < 0 ? t : std::min(first, t);
+        last = std::max(last, t);
+    }
+    for(auto &entry : entries){
+        int64_t t = start ? entry->device()->capture_start() : entry->device()->capture_end();
+        if(t >= 0){
+            char offset[64];
+            snprintf(offset, sizeof(offset), " %s +%.3f ms", entry->name.c_str(), (t - first) / 1000.0);
+            line += offset;
+        }
+    }
+
+    int64_t skew = first < 0 ? 0 : last - first;
+    printf("Session %s skew %.3f ms:%s\n", start ? "start" : "stop", skew / 1000.0, line.c_str());
+    if(skew > session_config.max_skew_us){
+        printf("Session: %s skew above %d us\n", start ? "start" : "stop", session_config.max_skew_us);
+    }
+}
+
+
+// Host steady clock of every device, the common interval is what all of them captured
+void DeviceRegistry::write_session_sync(){
+    FILE *f = fopen((session_path / "session_sync.csv").c_str(), "w");
+    if(!f){
+        std::cerr << "Cannot create session_sync.csv" << std::endl;
+        return;
+    }
+    fprintf(f, "device,capture_start_us,capture_end_us\n");
+
+    int64_t common_start = -1, common_end = -1;
+    for(auto &entry : entries){
+        int64_t start = entry->device()->capture_start();
+        int64_t end = entry->device()->capture_end();
+        fprintf(f, "%s,%lld,%lld\n", entry->name.c_str(), (long long)start, (long long)end);
+        common_start = std::max(common_start, start);
+        common_end = common_end < 0 ? end : std::min(common_end, end);
+    }
+    fclose(f);
+
+    if(common_start >= 0 && common_end > common_start){
+        printf("Session: all devices captured for %.3f s\n", (common_end - common_start) / 1e6);
+    }
+}
+
+
+void DeviceRegistry::stop(){
+    for(auto &entry : entries){
+        if(entry->type != DeviceType::PROPHESEE){
+            entry->device()->stop();
+        }
+    }
+    for(bool master : {true, false}){
+        for(auto &entry : entries){
+            if(entry->type == DeviceType::PROPHESEE && entry->master() == master){
+                entry->device()->stop();
+            }
+        }
+    }
+}
+
+
+void DeviceRegistry::register_metrics(MetricsRegistry &metrics){
+    struct StorageGauges {
+        Device *device;
+        Gauge *depth;
+        Gauge *capacity;
+        Gauge *bytes;
+    };
+    std::vector<StorageGauges> gauges;
+
+    for(Device *device : device_list){
+        device->set_metrics(&metrics);
+
+        std::string labels = std::string("device=\"") + device->name() + "\"";
+        gauges.push_back({device,
+            &metrics.gauge("prophexi_queue_depth", "Frames or buffers waiting for the writer", labels),
+            &metrics.gauge("prophexi_queue_capacity", "Writer queue size, 0 when the device has none", labels),
+            &metrics.gauge("prophexi_bytes_written", "Bytes written since the recording started", labels)});
+    }
+
+    metrics.add_collector([gauges]() {
+        for(const StorageGauges &g : gauges){
+            StorageStatus status = g.device->storage_status();
+            g.depth->set(status.queue_depth);
+            g.capacity->set(status.queue_capacity);
+            g.bytes->set(status.bytes_written);
+        }
+    });
+}
+
+
+void DeviceRegistry::print_budgets(){
+    int total_threads = 0;
+    double total_mb = 0;
+
+    for(auto &entry : entries){
+        int threads = 1;
+        double buffer_mb = 0;
+
+        if(entry->ximea_config){
+            const Ximea_config &c = *entry->ximea_config;
+            threads += c.writer_threads + 1;    // Writers and telemetry
+            if(c.compression.codec != Codec::NONE){
+                threads += c.compression.threads;
+            }
+            buffer_mb = c.acq_buffer_size_mb;
+            printf("Device %s: ximea, %d threads, %d ring slots, %d MB driver buffers\n", entry->name.c_str(), threads,
+                   c.ring_slots, c.acq_buffer_size_mb);
+        } else {
+            const Prophesee_config &c = *entry->prophesee_config;
+            // Each queue slot keeps a full SDK buffer of 4096 events
+            uint32_t buffers = c.event_queue;
+            threads += 1;                       // CD consumer
+            if(c.representations.enabled){
+                threads += 1 + c.representations.threads;
+                buffers += c.representations.queue;
+            }
+            buffer_mb = buffers * 4096.0 * sizeof(Metavision::EventCD) / (1 << 20);
+            printf("Device %s: prophesee %s, %d threads, %u event buffers (%.1f MB)\n", entry->name.c_str(),
+                   c.master ? "master" : "slave", threads, buffers, buffer_mb);
+        }
+
+        total_threads += threads;
+        total_mb += buffer_mb;
+    }
+
+    unsigned cores = std::thread::hardware_concurrency();
+    printf("Devices: %zu, %d threads on %u cores, %.0f MB of buffers\n", entries.size(), total_threads, cores, total_mb);
+    if(cores && (unsigned)total_threads > 2 * cores){
+        printf("Devices: more than two threads per core, lower writer_threads or compress_threads\n");
+    }
+}
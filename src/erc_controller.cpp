@@ -0,0 +1,63 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "erc_controller.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+
+uint32_t ErcController::update(double now_s, double measured_ev_s, double write_mb_s, uint32_t current, uint32_t ceiling,
+                               std::string &reason){
+    if(now_s - last_change_s < config.hold_ms / 1e3 || current == 0){
+        return current;
+    }
+
+    double min_rate = config.min_mev * 1e6;
+    double max_rate = config.max_mev * 1e6;
+    if(ceiling > 0){
+        max_rate = std::min(max_rate, (double)ceiling);
+    }
+
+    bool over_budget = config.max_write_mb_s > 0 && write_mb_s > config.max_write_mb_s;
+    bool room_to_raise = config.max_write_mb_s <= 0 || write_mb_s * config.step <= config.max_write_mb_s;
+
+    double target = current;
+    if(over_budget){
+        target = current / config.step;
+        reason = "write_budget";
+    } else if(measured_ev_s >= config.high * current && room_to_raise){
+        target = current * config.step;
+        reason = "saturated";
+    } else if(measured_ev_s < config.low * current){
+        // Down to where the measured rate sits in the middle of the band, one step at most
+        target = std::max(measured_ev_s / ((config.high + config.low) / 2), current / config.step);
+        reason = "quiet";
+    } else if(current > max_rate){
+        reason = "ceiling";
+    } else {
+        return current;
+    }
+
+    target = std::min(std::max(target, min_rate), max_rate);
+
+    // Changes below 1% are not worth a register write
+    if(std::fabs(target - current) < 0.01 * current){
+        return current;
+    }
+
+    last_change_s = now_s;
+    return (uint32_t)target;
+}
@@ -0,0 +1,71 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "event_queue.hpp"
+
+
+LatencyStats::LatencyStats() : count(0), total_ns(0), max_ns(0), reset_requested(false) {
+    for(int i = 0; i < BUCKETS; i++){
+        buckets[i] = 0;
+    }
+}
+
+
+void LatencyStats::add(uint64_t ns){
+    if(reset_requested.load(std::memory_order_relaxed)){
+        for(int i = 0; i < BUCKETS; i++){
+            buckets[i].store(0, std::memory_order_relaxed);
+        }
+        count.store(0, std::memory_order_relaxed);
+        total_ns.store(0, std::memory_order_relaxed);
+        max_ns.store(0, std::memory_order_relaxed);
+        reset_requested = false;
+    }
+
+    // Single writer, plain load + store is enough
+    int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    if(bucket >= BUCKETS){
+        bucket = BUCKETS - 1;
+    }
+    buckets[bucket].store(buckets[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    total_ns.store(total_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    if(ns > max_ns.load(std::memory_order_relaxed)){
+        max_ns.store(ns, std::memory_order_relaxed);
+    }
+}
+
+
+LatencyStats::Summary LatencyStats::summary() const {
+    Summary s;
+    s.count = count.load(std::memory_order_relaxed);
+    s.mean_us = s.count ? total_ns.load(std::memory_order_relaxed) / 1e3 / s.count : 0;
+    s.max_us = max_ns.load(std::memory_order_relaxed) / 1e3;
+
+    // Upper edge of the bucket holding the 99th percentile
+    s.p99_us = 0;
+    uint64_t seen = 0;
+    for(int i = 0; i < BUCKETS && s.count; i++){
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if(seen * 100 >= s.count * 99){
+            s.p99_us = (1ull << i) / 1e3;
+            break;
+        }
+    }
+    if(s.p99_us > s.max_us){
+        s.p99_us = s.max_us;
+    }
+    return s;
+}
@@ -0,0 +1,576 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "file_backend.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define BACKEND_URING
+#endif
+
+
+// Logical block size limit for O_DIRECT, offsets, sizes and buffers are aligned to it
+static const size_t DIRECT_ALIGNMENT = 4096;
+
+
+IoBackend io_backend_from_string(const std::string &name){
+    if(name == "buffered"){
+        return IoBackend::BUFFERED;
+    } else if(name == "direct"){
+        return IoBackend::DIRECT;
+    } else if(name == "io_uring"){
+        return IoBackend::URING;
+    }
+
+    std::cerr << "Unknown io backend: " << name << std::endl;
+    throw "Unknown io backend";
+}
+
+const char* io_backend_name(IoBackend backend){
+    switch(backend){
+        case IoBackend::BUFFERED: return "buffered";
+        case IoBackend::DIRECT:   return "direct";
+        case IoBackend::URING:    return "io_uring";
+    }
+    return "unknown";
+}
+
+
+static void pwrite_all(int fd, const void *data, size_t size, uint64_t offset){
+    const uint8_t *ptr = (const uint8_t*)data;
+    while(size > 0){
+        ssize_t n = pwrite(fd, ptr, size, offset);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            std::cerr << "pwrite: " << strerror(errno) << std::endl;
+            throw "Failed to write file";
+        }
+        ptr += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+static void preallocate(int fd, uint64_t bytes){
+    if(bytes == 0){
+        return;
+    }
+    // Extends the file size too, so O_DIRECT writes never have to grow it
+    if(fallocate(fd, 0, 0, bytes) != 0){
+        std::cerr << "fallocate of " << bytes << " bytes failed: " << strerror(errno) << ", writing without preallocation" << std::endl;
+    }
+}
+
+
+
+class BufferedFileBackend : public FileBackend {
+public:
+    BufferedFileBackend(int fd, bool preallocated) : fd(fd), preallocated(preallocated) {}
+
+    ~BufferedFileBackend(){
+        if(fd >= 0){
+            ::close(fd);
+        }
+    }
+
+    void write(const void *data, size_t size, uint64_t offset){
+        pwrite_all(fd, data, size, offset);
+    }
+
+    void finish(uint64_t size){
+        if(fd < 0){
+            return;
+        }
+        if(preallocated && ftruncate(fd, size) != 0){
+            std::cerr << "ftruncate: " << strerror(errno) << std::endl;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+
+    IoBackend backend() const { return IoBackend::BUFFERED; }
+
+private:
+    int fd;
+    bool preallocated;
+};
+
+
+
+#ifdef BACKEND_URING
+
+// Just enough of io_uring for queued writes, without liburing
+class Uring {
+public:
+    Uring() : ring_fd(-1), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED), sqes_ptr(MAP_FAILED) {}
+
+    ~Uring(){
+        if(sqes_ptr != MAP_FAILED) munmap(sqes_ptr, sqes_size);
+        if(cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+        if(sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+        if(ring_fd >= 0) ::close(ring_fd);
+    }
+
+    bool init(unsigned entries){
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+        if(ring_fd < 0){
+            return false;
+        }
+
+        sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if(p.features & IORING_FEAT_SINGLE_MMAP){
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        }
+
+        sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if(sq_ptr == MAP_FAILED){
+            return false;
+        }
+        if(p.features & IORING_FEAT_SINGLE_MMAP){
+            cq_ptr = sq_ptr;
+        } else {
+            cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if(cq_ptr == MAP_FAILED){
+                return false;
+            }
+        }
+        sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        sqes_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if(sqes_ptr == MAP_FAILED){
+            return false;
+        }
+
+        uint8_t *sq = (uint8_t*)sq_ptr;
+        uint8_t *cq = (uint8_t*)cq_ptr;
+        sq_tail = (unsigned*)(sq + p.sq_off.tail);
+        sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + p.sq_off.array);
+        sqes = (io_uring_sqe*)sqes_ptr;
+        cq_head = (unsigned*)(cq + p.cq_off.head);
+        cq_tail = (unsigned*)(cq + p.cq_off.tail);
+        cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    // IORING_OP_WRITE and the probe both came with Linux 5.6, older kernels accept io_uring_setup()
+    // but fail every write with EINVAL
+    bool supports(unsigned opcode){
+        const unsigned n_ops = 256;
+        std::vector<uint8_t> buffer(sizeof(io_uring_probe) + n_ops * sizeof(io_uring_probe_op), 0);
+        io_uring_probe *probe = (io_uring_probe*)buffer.data();
+        if(syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, n_ops) < 0){
+            return false;
+        }
+        return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    // Single submitter, the caller never queues more than the ring holds
+    void queue_write(int fd, const void *data, unsigned size, uint64_t offset, uint64_t user_data){
+        unsigned tail = *sq_tail;
+        unsigned index = tail & sq_mask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)data;
+        sqe->len = size;
+        sqe->off = offset;
+        sqe->user_data = user_data;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    int enter(unsigned to_submit, unsigned min_complete){
+        int ret;
+        do {
+            ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                          min_complete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        } while(ret < 0 && errno == EINTR);
+        return ret;
+    }
+
+    bool pop(io_uring_cqe &cqe){
+        unsigned head = *cq_head;
+        if(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)){
+            return false;
+        }
+        cqe = cqes[head & cq_mask];
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    int ring_fd;
+    void *sq_ptr, *cq_ptr, *sqes_ptr;
+    size_t sq_size, cq_size, sqes_size;
+
+    unsigned *sq_tail, *sq_array;
+    unsigned sq_mask;
+    io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe *cqes;
+};
+
+#endif
+
+
+
+/*
+ * Write combining for O_DIRECT. The file is cut into blocks of block_bytes, block k is staged in
+ * buffer k % queue_depth. Writers copy their pieces into the staged blocks and the writer that
+ * completes a block queues it for the I/O threads. A buffer only takes its next block once the
+ * previous one is on disk, blocks are therefore assigned in order and writers never wait on
+ * a block that depends on themselves.
+ */
+class StagedFileBackend : public FileBackend {
+public:
+    StagedFileBackend(int fd, IoBackend mode, const FileBackendConfig &config) :
+        fd(fd), mode(mode), failed(false), stopping(false), in_flight(0), written_end(0)
+    {
+        block_bytes = (std::max(config.block_bytes, DIRECT_ALIGNMENT) + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+        blocks.resize(std::max(config.queue_depth, 2));
+
+        if(posix_memalign((void**)&storage, DIRECT_ALIGNMENT, block_bytes * blocks.size()) != 0){
+            ::close(fd);
+            throw "Failed to allocate staging buffers";
+        }
+        for(size_t i = 0; i < blocks.size(); i++){
+            blocks[i].data = storage + i * block_bytes;
+            blocks[i].next = i;
+        }
+
+#ifdef BACKEND_URING
+        if(mode == IoBackend::URING){
+            threads.emplace_back(&StagedFileBackend::run_uring, this);
+            return;
+        }
+#endif
+        int n_threads = std::min<int>(blocks.size(), 4);
+        for(int i = 0; i < n_threads; i++){
+            threads.emplace_back(&StagedFileBackend::run_pwrite, this);
+        }
+    }
+
+    ~StagedFileBackend(){
+        try {
+            finish(written_end);
+        } catch(const char* err) {
+            std::cerr << err << std::endl;
+        }
+        free(storage);
+    }
+
+    void write(const void *data, size_t size, uint64_t offset){
+        const uint8_t *src = (const uint8_t*)data;
+
+        while(size > 0){
+            uint64_t id = offset / block_bytes;
+            size_t within = offset % block_bytes;
+            size_t part = std::min(size, block_bytes - within);
+            Block &block = blocks[id % blocks.size()];
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                block_free.wait(lock, [&]() { return failed || block.id == (int64_t)id || (block.id < 0 && block.next == id); });
+                if(failed){
+                    throw "Frame file write failed";
+                }
+                if(block.id < 0){
+                    block.id = id;
+                    block.filled = 0;
+                }
+            }
+
+            // The block cannot be queued before these bytes are accounted for
+            memcpy(block.data + within, src, part);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                block.filled += part;
+                written_end = std::max<uint64_t>(written_end, offset + part);
+                if(block.filled == block_bytes){
+                    queue_block(block, block_bytes);
+                }
+            }
+
+            src += part;
+            size -= part;
+            offset += part;
+        }
+    }
+
+    void finish(uint64_t size){
+        if(fd < 0){
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            // Partially filled tail, written as whole aligned blocks and trimmed below
+            for(Block &block : blocks){
+                if(block.id >= 0 && !block.queued){
+                    uint64_t start = block.id * block_bytes;
+                    uint64_t bytes = size > start ? std::min<uint64_t>(size - start, block_bytes) : 0;
+                    bytes = (bytes + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+                    if(bytes > 0){
+                        queue_block(block, bytes);
+                    } else {
+                        block.id = -1;
+                    }
+                }
+            }
+            block_free.wait(lock, [this]() { return pending.empty() && in_flight == 0; });
+            stopping = true;
+        }
+        work.notify_all();
+        for(auto &t : threads){
+            t.join();
+        }
+        threads.clear();
+
+        bool write_failed = failed;
+        if(ftruncate(fd, size) != 0){
+            std::cerr << "ftruncate: " << strerror(errno) << std::endl;
+        }
+        ::close(fd);
+        fd = -1;
+
+        if(write_failed){
+            throw "Frame file write failed";
+        }
+    }
+
+    IoBackend backend() const { return mode; }
+
+private:
+    struct Block {
+        uint8_t *data = nullptr;
+        int64_t id = -1;            // Block of the file staged here, -1 when free
+        uint64_t next = 0;          // Block this buffer takes next
+        size_t filled = 0;
+        size_t write_bytes = 0;
+        bool queued = false;
+    };
+
+    int fd;
+    IoBackend mode;
+    size_t block_bytes;
+    uint8_t *storage;
+    std::vector<Block> blocks;
+
+    std::mutex mutex;
+    std::condition_variable block_free;
+    std::condition_variable work;
+    std::deque<Block*> pending;
+    bool failed;
+    bool stopping;
+    size_t in_flight;
+    uint64_t written_end;
+    std::vector<std::thread> threads;
+
+    // With the mutex held
+    void queue_block(Block &block, size_t bytes){
+        block.queued = true;
+        block.write_bytes = bytes;
+        pending.push_back(&block);
+        work.notify_one();
+    }
+
+    // With the mutex held
+    void complete(Block &block, bool ok){
+        if(!ok){
+            failed = true;
+        }
+        block.next = block.id + blocks.size();
+        block.id = -1;
+        block.queued = false;
+        in_flight--;
+        block_free.notify_all();
+    }
+
+    void run_pwrite(){
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true){
+            work.wait(lock, [this]() { return stopping || !pending.empty(); });
+            if(pending.empty()){
+                return;
+            }
+            Block *block = pending.front();
+            pending.pop_front();
+            in_flight++;
+            lock.unlock();
+
+            bool ok = true;
+            try {
+                pwrite_all(fd, block->data, block->write_bytes, block->id * block_bytes);
+            } catch(const char*) {
+                ok = false;
+            }
+
+            lock.lock();
+            complete(*block, ok);
+        }
+    }
+
+#ifdef BACKEND_URING
+    void run_uring(){
+        Uring ring;
+        if(!ring.init(blocks.size())){
+            // Set up before the file was opened in open(), this only fails on resource limits
+            std::cerr << "io_uring setup failed: " << strerror(errno) << ", using pwrite" << std::endl;
+            mode = IoBackend::DIRECT;
+            run_pwrite();
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true){
+            work.wait(lock, [this]() { return stopping || !pending.empty() || in_flight > 0; });
+            if(stopping && pending.empty() && in_flight == 0){
+                return;
+            }
+
+            unsigned submit = 0;
+            while(!pending.empty()){
+                Block *block = pending.front();
+                pending.pop_front();
+                ring.queue_write(fd, block->data, block->write_bytes, block->id * block_bytes, (uint64_t)block);
+                submit++;
+            }
+            in_flight += submit;
+            lock.unlock();
+
+            // Wait for at least one completion, new blocks are submitted on the next round
+            int ret = ring.enter(submit, 1);
+
+            lock.lock();
+            if(ret < 0){
+                std::cerr << "io_uring_enter: " << strerror(errno) << std::endl;
+                failed = true;
+            }
+            io_uring_cqe cqe;
+            while(ring.pop(cqe)){
+                Block *block = (Block*)cqe.user_data;
+                complete(*block, cqe.res == (int)block->write_bytes);
+            }
+            if(failed && ret < 0){
+                // Nothing will complete anymore, drop what is left
+                while(!pending.empty()){
+                    pending.pop_front();
+                }
+                in_flight = 0;
+                for(Block &block : blocks){
+                    block.id = -1;
+                    block.queued = false;
+                }
+                block_free.notify_all();
+            }
+        }
+    }
+#endif
+};
+
+
+
+#ifdef BACKEND_URING
+static bool uring_supported(){
+    static const bool supported = []() {
+        Uring ring;
+        return ring.init(2) && ring.supports(IORING_OP_WRITE);
+    }();
+    return supported;
+}
+#endif
+
+
+void preallocate_file(const std::string &path, uint64_t bytes){
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        std::cerr << "Cannot create " << path << ": " << strerror(errno) << std::endl;
+        throw "Preallocating output file";
+    }
+    preallocate(fd, bytes);
+    ::close(fd);
+}
+
+
+std::unique_ptr<FileBackend> FileBackend::open(const std::string &path, const FileBackendConfig &config){
+    IoBackend mode = config.backend;
+
+    if(mode == IoBackend::URING){
+#ifdef BACKEND_URING
+        if(!uring_supported()){
+            std::cerr << "io_uring writes not available (Linux 5.6 or later), writing " << path << " with pwrite" << std::endl;
+            mode = IoBackend::DIRECT;
+        }
+#else
+        mode = IoBackend::DIRECT;
+#endif
+    }
+
+    // A file preallocated to exactly this size by preallocate_file() is written in place
+    struct stat st;
+    bool preallocated = config.preallocate > 0 && stat(path.c_str(), &st) == 0 && (uint64_t)st.st_size == config.preallocate;
+
+    int flags = O_WRONLY | O_CREAT | (preallocated ? 0 : O_TRUNC);
+    int fd = -1;
+    if(mode != IoBackend::BUFFERED){
+        fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        if(fd < 0 && errno == EINVAL){
+            std::cerr << "O_DIRECT not supported for " << path << ", using buffered writes" << std::endl;
+            mode = IoBackend::BUFFERED;
+        }
+    }
+    if(mode == IoBackend::BUFFERED){
+        fd = ::open(path.c_str(), flags, 0644);
+    }
+    if(fd < 0){
+        std::cerr << "Cannot create " << path << ": " << strerror(errno) << std::endl;
+        throw "Opening output file";
+    }
+
+    if(!preallocated){
+        preallocate(fd, config.preallocate);
+    }
+
+    if(mode == IoBackend::BUFFERED){
+        return std::unique_ptr<FileBackend>(new BufferedFileBackend(fd, config.preallocate > 0));
+    }
+    return std::unique_ptr<FileBackend>(new StagedFileBackend(fd, mode, config));
+}
@@ -0,0 +1,218 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#include "frame_codec.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <zlib.h>
+
+#ifdef PROPHEXI_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef PROPHEXI_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+
+
+Codec codec_from_string(const std::string &name){
+    if(name == "none"){
+        return Codec::NONE;
+    } else if(name == "deflate"){
+        return Codec::DEFLATE;
+    }
+#ifdef PROPHEXI_HAVE_ZSTD
+    else if(name == "zstd"){
+        return Codec::ZSTD;
+    }
+#endif
+#ifdef PROPHEXI_HAVE_LZ4
+    else if(name == "lz4"){
+        return Codec::LZ4;
+    }
+#endif
+
+    std::cerr << "Unknown or unavailable codec: " << name << std::endl;
+    throw "Unknown codec";
+}
+
+const char* codec_name(Codec codec){
+    switch(codec){
+        case Codec::NONE:    return "none";
+        case Codec::DEFLATE: return "deflate";
+        case Codec::ZSTD:    return "zstd";
+        case Codec::LZ4:     return "lz4";
+    }
+    return "unknown";
+}
+
+
+
+static size_t compress_bound(Codec codec, size_t n){
+    switch(codec){
+        case Codec::DEFLATE:
+            return compressBound(n);
+#ifdef PROPHEXI_HAVE_ZSTD
+        case Codec::ZSTD:
+            return ZSTD_compressBound(n);
+#endif
+#ifdef PROPHEXI_HAVE_LZ4
+        case Codec::LZ4:
+            return LZ4_compressBound(n);
+#endif
+        default:
+            return n;
+    }
+}
+
+
+static size_t compress_block(Codec codec, int level, const uint8_t *src, size_t n, uint8_t *dst, size_t cap){
+    switch(codec){
+        case Codec::DEFLATE: {
+            uLongf out = cap;
+            if(compress2(dst, &out, src, n, level) != Z_OK){
+                throw "deflate failed";
+            }
+            return out;
+        }
+#ifdef PROPHEXI_HAVE_ZSTD
+        case Codec::ZSTD: {
+            size_t out = ZSTD_compress(dst, cap, src, n, level);
+            if(ZSTD_isError(out)){
+                throw "zstd failed";
+            }
+            return out;
+        }
+#endif
+#ifdef PROPHEXI_HAVE_LZ4
+        case Codec::LZ4: {
+            // Higher level means faster and larger for LZ4
+            int out = LZ4_compress_fast((const char*)src, (char*)dst, n, cap, level);
+            if(out <= 0){
+                throw "lz4 failed";
+            }
+            return out;
+        }
+#endif
+        default:
+            memcpy(dst, src, n);
+            return n;
+    }
+}
+
+
+size_t decompress_strip(Codec codec, const uint8_t *src, size_t src_bytes, uint8_t *dst, size_t dst_bytes){
+    switch(codec){
+        case Codec::DEFLATE: {
+            uLongf out = dst_bytes;
+            if(uncompress(dst, &out, src, src_bytes) != Z_OK){
+                throw "inflate failed";
+            }
+            return out;
+        }
+#ifdef PROPHEXI_HAVE_ZSTD
+        case Codec::ZSTD: {
+            size_t out = ZSTD_decompress(dst, dst_bytes, src, src_bytes);
+            if(ZSTD_isError(out)){
+                throw "zstd decompression failed";
+            }
+            return out;
+        }
+#endif
+#ifdef PROPHEXI_HAVE_LZ4
+        case Codec::LZ4: {
+            int out = LZ4_decompress_safe((const char*)src, (char*)dst, src_bytes, dst_bytes);
+            if(out < 0){
+                throw "lz4 decompression failed";
+            }
+            return out;
+        }
+#endif
+        case Codec::NONE:
+            if(src_bytes > dst_bytes){
+                throw "Strip larger than the frame";
+            }
+            memcpy(dst, src, src_bytes);
+            return src_bytes;
+
+        default:
+            throw "Codec not compiled in";
+    }
+}
+
+
+
+void apply_predictor16(const uint8_t *src, uint8_t *dst, size_t row_bytes, int rows){
+    size_t n = row_bytes / 2;
+
+    for(int y = 0; y < rows; y++){
+        const uint16_t *s = (const uint16_t*)(src + y * row_bytes);
+        uint16_t *d = (uint16_t*)(dst + y * row_bytes);
+
+        d[0] = s[0];
+        for(size_t x = 1; x < n; x++){
+            d[x] = s[x] - s[x - 1];
+        }
+    }
+}
+
+void undo_predictor16(uint8_t *data, size_t row_bytes, int rows){
+    size_t n = row_bytes / 2;
+
+    for(int y = 0; y < rows; y++){
+        uint16_t *d = (uint16_t*)(data + y * row_bytes);
+        for(size_t x = 1; x < n; x++){
+            d[x] += d[x - 1];
+        }
+    }
+}
+
+
+
+StripCompressor::StripCompressor(const CompressionConfig &config) :
+    config(config), pool(config.threads > 1 ? config.threads - 1 : 0)
+{
+}
+
+
+void StripCompressor::compress(const uint8_t *data, size_t row_bytes, int rows, int bits_per_sample,
+                               std::vector<std::vector<uint8_t>> &strips){
+    int rows_per_strip = config.rows_per_strip > 0 ? config.rows_per_strip : rows;
+    size_t n_strips = (rows + rows_per_strip - 1) / rows_per_strip;
+    bool predictor = config.predictor && bits_per_sample == 16;
+
+    strips.resize(n_strips);
+
+    pool.parallel_for(n_strips, [&](size_t s) {
+        int first_row = s * rows_per_strip;
+        int strip_rows = std::min(rows_per_strip, rows - first_row);
+        size_t strip_bytes = strip_rows * row_bytes;
+        const uint8_t *src = data + first_row * row_bytes;
+
+        if(predictor){
+            thread_local std::vector<uint8_t> differenced;
+            differenced.resize(strip_bytes);
+            apply_predictor16(src, differenced.data(), row_bytes, strip_rows);
+            src = differenced.data();
+        }
+
+        std::vector<uint8_t> &out = strips[s];
+        out.resize(compress_bound(config.codec, strip_bytes));
+        out.resize(compress_block(config.codec, config.level, src, strip_bytes, out.data(), out.size()));
+    });
+}
@@ -0,0 +1,270 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#include "frame_container.hpp"
+#include "pack10.hpp"
+#include "frame_codec.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+FrameContainerWriter::FrameContainerWriter(const std::string &path, int width, int height, int cv_type,
+                                           int significant_bits, int bit_shift, uint32_t pixel_format,
+                                           const FileBackendConfig &io) :
+    closed(false), header_written(false), end_offset(CONTAINER_HEADER_SIZE)
+{
+    file = FileBackend::open(path, io);
+
+    memset(header_block, 0, sizeof(header_block));
+    ContainerHeader *hdr = (ContainerHeader*)header_block;
+
+    memcpy(hdr->magic, CONTAINER_MAGIC, sizeof(hdr->magic));
+    hdr->version = CONTAINER_VERSION;
+    hdr->header_size = CONTAINER_HEADER_SIZE;
+    hdr->width = width;
+    hdr->height = height;
+    hdr->cv_type = cv_type;
+    hdr->frame_bytes = width * height * CV_ELEM_SIZE(cv_type);
+    hdr->created_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    hdr->significant_bits = significant_bits;
+    hdr->bit_shift = bit_shift;
+    hdr->pixel_format = pixel_format;
+}
+
+// The header goes out with the first frame, until then it can still be changed
+void FrameContainerWriter::set_compression(uint32_t codec, uint32_t rows_per_strip, bool predictor){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(header_written){
+        throw "Frame container header already written";
+    }
+    ContainerHeader *hdr = (ContainerHeader*)header_block;
+    hdr->codec = codec;
+    hdr->rows_per_strip = rows_per_strip;
+    hdr->predictor = predictor;
+}
+
+FrameContainerWriter::~FrameContainerWriter(){
+    try {
+        close();
+    } catch(const char* err) {
+        std::cerr << err << std::endl;
+    }
+}
+
+
+void FrameContainerWriter::write(const FrameMeta &meta, const void *payload, size_t payload_bytes){
+    ChunkHeader chunk;
+    memset(&chunk, 0, sizeof(chunk));
+    chunk.magic = CONTAINER_CHUNK_MAGIC;
+    chunk.record.payload_bytes = payload_bytes;
+    chunk.record.frame_id = meta.frame_id;
+    chunk.record.ts_us = meta.ts_us;
+    chunk.record.exposure_us = meta.exposure_us;
+    chunk.record.gain_db = meta.gain_db;
+    chunk.record.skipped_frames = meta.skipped_frames;
+
+    size_t chunk_bytes = sizeof(ChunkHeader) + payload_bytes;
+    size_t padding = (CONTAINER_CHUNK_ALIGN - chunk_bytes % CONTAINER_CHUNK_ALIGN) % CONTAINER_CHUNK_ALIGN;
+    chunk_bytes += padding;
+
+    // Only the space reservation is serialized, the writers fill their chunks in parallel
+    uint64_t offset;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(closed){
+            throw "Frame container already closed";
+        }
+        if(!header_written){
+            file->write(header_block, sizeof(header_block), 0);
+            header_written = true;
+        }
+        offset = end_offset;
+        end_offset += chunk_bytes;
+    }
+
+    chunk.record.offset = offset + sizeof(ChunkHeader);
+
+    // The padding is written too, staged backends only flush completely written blocks
+    static const uint8_t zeros[CONTAINER_CHUNK_ALIGN] = {0};
+    file->write(&chunk, sizeof(chunk), offset);
+    file->write(payload, payload_bytes, chunk.record.offset);
+    if(padding){
+        file->write(zeros, padding, chunk.record.offset + payload_bytes);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    index.push_back(chunk.record);
+}
+
+
+void FrameContainerWriter::close(){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(closed){
+        return;
+    }
+    closed = true;
+
+    if(!header_written){
+        file->write(header_block, sizeof(header_block), 0);
+        header_written = true;
+    }
+
+    std::sort(index.begin(), index.end(), [](const ContainerRecord &a, const ContainerRecord &b) {
+        return a.frame_id < b.frame_id;
+    });
+
+    ContainerFooter footer;
+    memcpy(footer.magic, CONTAINER_INDEX_MAGIC, sizeof(footer.magic));
+    footer.index_offset = end_offset;
+    footer.frame_count = index.size();
+
+    file->write(index.data(), index.size() * sizeof(ContainerRecord), end_offset);
+    end_offset += index.size() * sizeof(ContainerRecord);
+    file->write(&footer, sizeof(footer), end_offset);
+    end_offset += sizeof(footer);
+
+    file->finish(end_offset);
+}
+
+
+uint64_t FrameContainerWriter::bytes_written(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return end_offset;
+}
+
+
+
+
+FrameContainerReader::FrameContainerReader(const std::string &path) : base(nullptr), indexed(false) {
+    fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        std::cerr << "Cannot open " << path << ": " << strerror(errno) << std::endl;
+        throw "Opening frame container";
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < CONTAINER_HEADER_SIZE){
+        ::close(fd);
+        throw "Not a frame container";
+    }
+    file_size = st.st_size;
+
+    void *map = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED){
+        ::close(fd);
+        throw "Failed to map frame container";
+    }
+    base = (uint8_t*)map;
+    madvise(base, file_size, MADV_SEQUENTIAL);
+
+    hdr = (const ContainerHeader*)base;
+    if(memcmp(hdr->magic, CONTAINER_MAGIC, sizeof(hdr->magic)) != 0){
+        munmap(base, file_size);
+        ::close(fd);
+        throw "Not a frame container";
+    }
+
+    const ContainerFooter *footer = (const ContainerFooter*)(base + file_size - sizeof(ContainerFooter));
+    if(memcmp(footer->magic, CONTAINER_INDEX_MAGIC, sizeof(footer->magic)) == 0 &&
+       footer->index_offset + footer->frame_count * sizeof(ContainerRecord) + sizeof(ContainerFooter) == file_size){
+        const ContainerRecord *first = (const ContainerRecord*)(base + footer->index_offset);
+        records.assign(first, first + footer->frame_count);
+        indexed = true;
+    } else {
+        scan_chunks();
+    }
+}
+
+FrameContainerReader::~FrameContainerReader(){
+    munmap(base, file_size);
+    ::close(fd);
+}
+
+
+void FrameContainerReader::scan_chunks(){
+    size_t offset = hdr->header_size;
+
+    while(offset + sizeof(ChunkHeader) <= file_size){
+        const ChunkHeader *chunk = (const ChunkHeader*)(base + offset);
+        if(chunk->magic != CONTAINER_CHUNK_MAGIC || chunk->record.offset + chunk->record.payload_bytes > file_size){
+            break;
+        }
+        records.push_back(chunk->record);
+
+        size_t chunk_bytes = sizeof(ChunkHeader) + chunk->record.payload_bytes;
+        offset += (chunk_bytes + CONTAINER_CHUNK_ALIGN - 1) / CONTAINER_CHUNK_ALIGN * CONTAINER_CHUNK_ALIGN;
+    }
+
+    std::sort(records.begin(), records.end(), [](const ContainerRecord &a, const ContainerRecord &b) {
+        return a.frame_id < b.frame_id;
+    });
+}
+
+
+cv::Mat FrameContainerReader::image(size_t i) const {
+    return cv::Mat(hdr->height, hdr->width, hdr->cv_type, (void*)payload(i));
+}
+
+
+void FrameContainerReader::decode(size_t i, cv::Mat &out) const {
+    bool packed = hdr->pixel_format == CONTAINER_PIXELS_PACKED10;
+    const uint8_t *stored = payload(i);
+
+    out.create(hdr->height, hdr->width, packed ? CV_16UC1 : hdr->cv_type);
+
+    thread_local std::vector<uint8_t> decompressed;
+    if((Codec)hdr->codec != Codec::NONE){
+        size_t row_bytes = packed ? packed10_row_bytes(hdr->width) : hdr->width * CV_ELEM_SIZE(hdr->cv_type);
+        size_t stored_bytes = row_bytes * hdr->height;
+
+        // Unpacked frames decompress straight into the output
+        uint8_t *dst = out.data;
+        if(packed){
+            decompressed.resize(stored_bytes);
+            dst = decompressed.data();
+        }
+
+        const uint32_t *table = (const uint32_t*)stored;
+        const uint8_t *strip = stored + sizeof(uint32_t) * (1 + table[0]);
+        size_t offset = 0;
+        for(uint32_t s = 0; s < table[0]; s++){
+            offset += decompress_strip((Codec)hdr->codec, strip, table[1 + s], dst + offset, stored_bytes - offset);
+            strip += table[1 + s];
+        }
+        if(offset != stored_bytes){
+            throw "Compressed frame has the wrong size";
+        }
+
+        if(hdr->predictor){
+            undo_predictor16(dst, row_bytes, hdr->height);
+        }
+        stored = dst;
+    }
+
+    if(packed){
+        unpack10_image(stored, (uint16_t*)out.data, out.step, hdr->width, hdr->height, hdr->bit_shift);
+    } else if(stored != out.data){
+        memcpy(out.data, stored, hdr->frame_bytes);
+    }
+}
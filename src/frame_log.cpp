@@ -0,0 +1,131 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "frame_log.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+static void write_all(int fd, const void *data, size_t size){
+    const uint8_t *ptr = (const uint8_t*)data;
+    while(size > 0){
+        ssize_t n = ::write(fd, ptr, size);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            throw "Failed to write frame log";
+        }
+        ptr += n;
+        size -= n;
+    }
+}
+
+
+
+FrameLogWriter::FrameLogWriter(const std::string &path, size_t batch_records) : buffer(batch_records > 0 ? batch_records : 1), count(0) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        std::cerr << "Cannot create " << path << ": " << strerror(errno) << std::endl;
+        throw "Opening frame log";
+    }
+
+    FrameLogHeader header;
+    memcpy(header.magic, FRAME_LOG_MAGIC, sizeof(header.magic));
+    header.version = FRAME_LOG_VERSION;
+    header.record_size = sizeof(FrameLogRecord);
+    write_all(fd, &header, sizeof(header));
+}
+
+FrameLogWriter::~FrameLogWriter(){
+    try {
+        close();
+    } catch(const char* err) {
+        std::cerr << err << std::endl;
+    }
+}
+
+
+void FrameLogWriter::flush(){
+    if(fd < 0 || count == 0){
+        return;
+    }
+    write_all(fd, buffer.data(), count * sizeof(FrameLogRecord));
+    count = 0;
+}
+
+
+void FrameLogWriter::close(){
+    if(fd < 0){
+        return;
+    }
+    flush();
+    ::close(fd);
+    fd = -1;
+}
+
+
+
+std::vector<FrameLogRecord> read_frame_log(const std::string &path){
+    FILE *file = fopen(path.c_str(), "rb");
+    if(!file){
+        std::cerr << "Cannot open " << path << ": " << strerror(errno) << std::endl;
+        throw "Opening frame log";
+    }
+
+    FrameLogHeader header;
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, FRAME_LOG_MAGIC, sizeof(header.magic)) != 0){
+        fclose(file);
+        throw "Not a frame log";
+    }
+    if(header.record_size != sizeof(FrameLogRecord)){
+        fclose(file);
+        throw "Unsupported frame log record size";
+    }
+
+    std::vector<FrameLogRecord> records;
+    FrameLogRecord record;
+    while(fread(&record, sizeof(record), 1, file) == 1){
+        records.push_back(record);
+    }
+    fclose(file);
+
+    return records;
+}
+
+
+void frame_log_to_csv(const std::string &log_path, const std::string &csv_path){
+    std::vector<FrameLogRecord> records = read_frame_log(log_path);
+
+    FILE *csv = fopen(csv_path.c_str(), "w");
+    if(!csv){
+        std::cerr << "Cannot create " << csv_path << ": " << strerror(errno) << std::endl;
+        throw "Opening timestamp CSV";
+    }
+
+    // Same text as the std::to_string() based writer, exposure in ms
+    fprintf(csv, "frame_id,ts, exposure, gain, skip_frames\n");
+    for(const FrameLogRecord &r : records){
+        fprintf(csv, "%d, %lld, %f, %f, %d\n", r.frame_id, (long long)r.ts_us, r.exposure_us / 1000.0,
+                (double)r.gain_db, r.skipped_frames);
+    }
+    fclose(csv);
+}
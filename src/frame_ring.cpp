@@ -0,0 +1,228 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#include "frame_ring.hpp"
+
+#include <cstdlib>
+#include <iostream>
+
+
+// Page aligned slots, so the buffers can also be handed to O_DIRECT style writers
+static const size_t SLOT_ALIGNMENT = 4096;
+
+
+RingPolicy ring_policy_from_string(const std::string &name){
+    if(name == "block"){
+        return RingPolicy::BLOCK;
+    } else if(name == "drop_oldest"){
+        return RingPolicy::DROP_OLDEST;
+    } else if(name == "drop_newest"){
+        return RingPolicy::DROP_NEWEST;
+    }
+
+    std::cerr << "Unknown ring policy: " << name << std::endl;
+    throw "Unknown ring policy";
+}
+
+const char* ring_policy_name(RingPolicy policy){
+    switch(policy){
+        case RingPolicy::BLOCK:       return "block";
+        case RingPolicy::DROP_OLDEST: return "drop_oldest";
+        case RingPolicy::DROP_NEWEST: return "drop_newest";
+    }
+    return "unknown";
+}
+
+
+
+FrameRing::FrameRing(size_t n_slots, int rows, int cols, int type, RingPolicy policy) :
+    policy(policy), closed(true), rows(rows), cols(cols), type(type), storage(nullptr),
+    queue_head(0), queue_count(0), in_flight(0),
+    high_water(0), published(0), dropped_oldest(0), dropped_newest(0)
+{
+    if(n_slots == 0){
+        throw "Frame ring needs at least one slot";
+    }
+
+    size_t image_bytes = (size_t)rows * cols * CV_ELEM_SIZE(type);
+    slot_bytes = (image_bytes + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+
+    if(posix_memalign((void**)&storage, SLOT_ALIGNMENT, slot_bytes * n_slots) != 0){
+        throw "Failed to allocate frame ring";
+    }
+
+    slots.resize(n_slots);
+    free_slots.reserve(n_slots);
+    queue.resize(n_slots, nullptr);
+
+    for(size_t i = 0; i < n_slots; i++){
+        slots[i].image = cv::Mat(rows, cols, type, storage + i * slot_bytes);
+        slots[i].index = i;
+        slots[i].lease = 0;
+        free_slots.push_back(&slots[i]);
+    }
+}
+
+FrameRing::~FrameRing(){
+    free(storage);
+}
+
+
+FrameSlot* FrameRing::acquire(){
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if(free_slots.empty()){
+        switch(policy){
+            case RingPolicy::BLOCK:
+                not_full.wait(lock, [this]() { return !free_slots.empty(); });
+                break;
+
+            case RingPolicy::DROP_OLDEST:
+                if(queue_count > 0){
+                    FrameSlot *oldest = queue[queue_head];
+                    queue_head = (queue_head + 1) % queue.size();
+                    queue_count--;
+                    dropped_oldest++;
+                    return oldest;
+                }
+                // Every slot is being written, nothing left to steal
+                dropped_newest++;
+                return nullptr;
+
+            case RingPolicy::DROP_NEWEST:
+                dropped_newest++;
+                return nullptr;
+        }
+    }
+
+    FrameSlot *slot = free_slots.back();
+    free_slots.pop_back();
+    return slot;
+}
+
+
+void FrameRing::publish(FrameSlot *slot){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        queue[(queue_head + queue_count) % queue.size()] = slot;
+        queue_count++;
+        published++;
+
+        if(queue_count > high_water){
+            high_water = queue_count;
+        }
+    }
+    not_empty.notify_one();
+}
+
+
+FrameSlot* FrameRing::pop(){
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this]() { return queue_count > 0 || closed; });
+
+    if(queue_count == 0){
+        return nullptr;
+    }
+
+    FrameSlot *slot = queue[queue_head];
+    queue_head = (queue_head + 1) % queue.size();
+    queue_count--;
+    in_flight++;
+
+    return slot;
+}
+
+
+void FrameRing::release(FrameSlot *slot){
+    bool returned = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(slot->lease){
+            slot->image = cv::Mat(rows, cols, type, storage + slot->index * slot_bytes);
+            slot->lease = 0;
+            returned = true;
+        }
+        free_slots.push_back(slot);
+        in_flight--;
+    }
+    not_full.notify_one();
+    if(returned){
+        lease_returned.notify_all();
+    }
+}
+
+
+void FrameRing::lend(FrameSlot *slot, void *buffer, uint64_t lease){
+    std::lock_guard<std::mutex> lock(mutex);
+    slot->image = cv::Mat(rows, cols, type, buffer);
+    slot->lease = lease;
+}
+
+
+void FrameRing::wait_leases(uint64_t oldest_allowed){
+    std::unique_lock<std::mutex> lock(mutex);
+    lease_returned.wait(lock, [this, oldest_allowed]() {
+        for(const FrameSlot &slot : slots){
+            if(slot.lease && slot.lease < oldest_allowed){
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+
+void FrameRing::open(){
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = false;
+    high_water = 0;
+    published = 0;
+    dropped_oldest = 0;
+    dropped_newest = 0;
+}
+
+
+void FrameRing::close(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    not_empty.notify_all();
+}
+
+
+size_t FrameRing::depth(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue_count + in_flight;
+}
+
+
+RingStats FrameRing::stats(){
+    std::lock_guard<std::mutex> lock(mutex);
+
+    RingStats s;
+    s.capacity = slots.size();
+    s.depth = queue_count;
+    s.in_flight = in_flight;
+    s.high_water = high_water;
+    s.published = published;
+    s.dropped_oldest = dropped_oldest;
+    s.dropped_newest = dropped_newest;
+    s.leases = 0;
+    for(const FrameSlot &slot : slots){
+        s.leases += slot.lease != 0;
+    }
+    return s;
+}
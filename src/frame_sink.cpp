@@ -0,0 +1,345 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#include "frame_sink.hpp"
+#include "pack10.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <tiffio.h>
+
+
+
+void WriteImage(cv::Mat& image, const char* filename, int significant_bits)
+{
+	TIFF* tiff_img = TIFFOpen(filename, "w");
+	if (!tiff_img)
+		throw "Opening image by TIFFOpen";
+
+	// set tiff tags
+	int width = image.cols;
+	int height = image.rows; 
+
+
+	int bits_per_sample = 8;
+    if(image.type() == CV_16U || image.type() == CV_16UC1 || image.type () == CV_16UC3){
+        bits_per_sample = 16;
+    }
+
+    int line_len = 0;
+	line_len = width * (bits_per_sample / 8);
+	// printf("Saving image %dx%d to file:%s\n", width, height, filename);
+
+	TIFFSetField(tiff_img, TIFFTAG_IMAGEWIDTH, width);
+	TIFFSetField(tiff_img, TIFFTAG_IMAGELENGTH, height);
+	TIFFSetField(tiff_img, TIFFTAG_ROWSPERSTRIP, height);
+	
+    TIFFSetField(tiff_img, TIFFTAG_BITSPERSAMPLE, bits_per_sample);
+	TIFFSetField(tiff_img, TIFFTAG_MINSAMPLEVALUE, 0);
+	TIFFSetField(tiff_img, TIFFTAG_MAXSAMPLEVALUE, (1 << (significant_bits > 0 ? significant_bits : bits_per_sample)) - 1);
+
+	TIFFSetField(tiff_img, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+	TIFFSetField(tiff_img, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+
+	if (image.type() == CV_16UC3 || image.type() == CV_8UC3){
+        TIFFSetField(tiff_img, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+	    TIFFSetField(tiff_img, TIFFTAG_SAMPLESPERPIXEL, 3);
+    } else {
+        TIFFSetField(tiff_img, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+	    TIFFSetField(tiff_img, TIFFTAG_SAMPLESPERPIXEL, 1);
+    }
+	//TIFFSetField(tiff_img, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
+	//TIFFSetField(tiff_img, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_INT);
+
+	// save data
+	if (TIFFWriteEncodedStrip(tiff_img, 0, image.data, line_len*height) == -1)
+	{
+		throw("ImageFailed to write image");
+	}
+
+	TIFFWriteDirectory(tiff_img);
+	TIFFClose(tiff_img);
+}
+
+
+
+
+void WritePacked10Image(const uint8_t *packed, int width, int height, const char* filename)
+{
+	TIFF* tiff_img = TIFFOpen(filename, "w");
+	if (!tiff_img)
+		throw "Opening image by TIFFOpen";
+
+	size_t line_len = packed10_row_bytes(width);
+
+	TIFFSetField(tiff_img, TIFFTAG_IMAGEWIDTH, width);
+	TIFFSetField(tiff_img, TIFFTAG_IMAGELENGTH, height);
+	TIFFSetField(tiff_img, TIFFTAG_ROWSPERSTRIP, height);
+
+	TIFFSetField(tiff_img, TIFFTAG_BITSPERSAMPLE, 10);
+	TIFFSetField(tiff_img, TIFFTAG_MINSAMPLEVALUE, 0);
+	TIFFSetField(tiff_img, TIFFTAG_MAXSAMPLEVALUE, (1 << 10) - 1);
+
+	TIFFSetField(tiff_img, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+	TIFFSetField(tiff_img, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(tiff_img, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+	TIFFSetField(tiff_img, TIFFTAG_SAMPLESPERPIXEL, 1);
+
+	if (TIFFWriteEncodedStrip(tiff_img, 0, (void*)packed, line_len*height) == -1)
+	{
+		TIFFClose(tiff_img);
+		throw("ImageFailed to write image");
+	}
+
+	TIFFWriteDirectory(tiff_img);
+	TIFFClose(tiff_img);
+}
+
+
+void ReadPacked10Image(const char* filename, cv::Mat &image, int bit_shift)
+{
+	TIFF* tiff_img = TIFFOpen(filename, "r");
+	if (!tiff_img)
+		throw "Opening image by TIFFOpen";
+
+	uint32_t width = 0, height = 0;
+	uint16_t bits_per_sample = 0;
+	TIFFGetField(tiff_img, TIFFTAG_IMAGEWIDTH, &width);
+	TIFFGetField(tiff_img, TIFFTAG_IMAGELENGTH, &height);
+	TIFFGetField(tiff_img, TIFFTAG_BITSPERSAMPLE, &bits_per_sample);
+
+	if (bits_per_sample != 10) {
+		TIFFClose(tiff_img);
+		throw "Not a 10 bit packed TIFF";
+	}
+
+	size_t line_len = packed10_row_bytes(width);
+	std::vector<uint8_t> packed(line_len * height);
+
+	// Strips hold whole rows, so they concatenate into the packed image
+	size_t offset = 0;
+	for (uint32_t strip = 0; strip < TIFFNumberOfStrips(tiff_img); strip++) {
+		tmsize_t n = TIFFReadEncodedStrip(tiff_img, strip, packed.data() + offset, packed.size() - offset);
+		if (n < 0) {
+			TIFFClose(tiff_img);
+			throw "Failed to read image";
+		}
+		offset += n;
+	}
+	TIFFClose(tiff_img);
+
+	image.create(height, width, CV_16UC1);
+	unpack10_image(packed.data(), (uint16_t*)image.data, image.step, width, height, bit_shift);
+}
+
+
+
+
+void WriteStripsImage(const std::vector<std::vector<uint8_t>> &strips, int width, int height, int rows_per_strip,
+                      int bits_per_sample, int significant_bits, Codec codec, bool predictor, const char* filename)
+{
+	TIFF* tiff_img = TIFFOpen(filename, "w");
+	if (!tiff_img)
+		throw "Opening image by TIFFOpen";
+
+	TIFFSetField(tiff_img, TIFFTAG_IMAGEWIDTH, width);
+	TIFFSetField(tiff_img, TIFFTAG_IMAGELENGTH, height);
+	TIFFSetField(tiff_img, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
+
+	TIFFSetField(tiff_img, TIFFTAG_BITSPERSAMPLE, bits_per_sample);
+	TIFFSetField(tiff_img, TIFFTAG_MINSAMPLEVALUE, 0);
+	TIFFSetField(tiff_img, TIFFTAG_MAXSAMPLEVALUE, (1 << (significant_bits > 0 ? significant_bits : bits_per_sample)) - 1);
+
+	TIFFSetField(tiff_img, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+	TIFFSetField(tiff_img, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(tiff_img, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+	TIFFSetField(tiff_img, TIFFTAG_SAMPLESPERPIXEL, 1);
+
+	TIFFSetField(tiff_img, TIFFTAG_COMPRESSION, codec == Codec::ZSTD ? COMPRESSION_ZSTD : COMPRESSION_ADOBE_DEFLATE);
+	TIFFSetField(tiff_img, TIFFTAG_PREDICTOR, predictor ? PREDICTOR_HORIZONTAL : PREDICTOR_NONE);
+
+	// Already compressed, libtiff only stores them
+	for (size_t s = 0; s < strips.size(); s++) {
+		if (TIFFWriteRawStrip(tiff_img, s, (void*)strips[s].data(), strips[s].size()) == -1)
+		{
+			TIFFClose(tiff_img);
+			throw("ImageFailed to write image");
+		}
+	}
+
+	TIFFWriteDirectory(tiff_img);
+	TIFFClose(tiff_img);
+}
+
+
+SinkType sink_type_from_string(const std::string &name){
+    if(name == "tiff"){
+        return SinkType::TIFF;
+    } else if(name == "container"){
+        return SinkType::CONTAINER;
+    }
+
+    std::cerr << "Unknown frame sink: " << name << std::endl;
+    throw "Unknown frame sink";
+}
+
+
+
+void print_sink_stats(const char *name, const SinkFormat &format, const SinkStats &stats){
+    printf("%s: %llu frames, %.1f MB raw, %.1f MB stored, ratio %.2f, %s%s %.0f MB/s per writer\n",
+        name, (unsigned long long)stats.frames.load(), stats.raw_bytes / 1e6, stats.stored_bytes / 1e6, stats.ratio(),
+        format.packed10 ? "packed10 + " : "", codec_name(format.compression.codec), stats.encode_mb_per_s());
+}
+
+
+
+FrameEncoder::FrameEncoder(const SinkFormat &format) : format(format) {
+    if(format.compression.codec != Codec::NONE){
+        compressor.reset(new StripCompressor(format.compression));
+    }
+}
+
+
+EncodedFrame FrameEncoder::encode(const FrameSlot &slot, SinkStats &stats){
+    const cv::Mat &image = slot.image;
+
+    EncodedFrame frame;
+    frame.rows = image.rows;
+    frame.strips = nullptr;
+
+    auto start = std::chrono::steady_clock::now();
+
+    if(format.packed10){
+        // One scratch buffer per writer thread
+        thread_local std::vector<uint8_t> packed;
+        frame.row_bytes = packed10_row_bytes(image.cols);
+        packed.resize(frame.row_bytes * image.rows);
+
+        pack10_image((const uint16_t*)image.data, image.step, packed.data(), image.cols, image.rows, format.bit_shift);
+
+        frame.data = packed.data();
+        frame.bits_per_sample = 10;
+    } else {
+        frame.row_bytes = image.cols * image.elemSize();
+        frame.data = image.data;
+        frame.bits_per_sample = image.elemSize1() * 8;
+    }
+    frame.bytes = frame.row_bytes * frame.rows;
+
+    size_t stored = frame.bytes;
+    if(compressor){
+        thread_local std::vector<std::vector<uint8_t>> strips;
+        compressor->compress(frame.data, frame.row_bytes, frame.rows, frame.bits_per_sample, strips);
+        frame.strips = &strips;
+
+        stored = 0;
+        for(const auto &strip : strips){
+            stored += strip.size();
+        }
+    }
+
+    if(format.packed10 || compressor){
+        stats.encode_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+    stats.frames++;
+    stats.raw_bytes += image.total() * image.elemSize();
+    stats.stored_bytes += stored;
+
+    return frame;
+}
+
+
+
+TiffFrameSink::TiffFrameSink(const fs::path &frames_path, const SinkFormat &format) :
+    FrameSink(format), frames_path(frames_path)
+{
+    if(format.compression.codec == Codec::LZ4){
+        throw "LZ4 is not a TIFF codec, use it with the container sink";
+    }
+
+    fs::create_directories(frames_path);
+}
+
+void TiffFrameSink::write(FrameSlot &slot){
+    char filename[100] = "";
+    sprintf(filename, "frame%06d.tif", slot.meta.frame_id);
+
+    fs::path img_path = frames_path / fs::path(filename);
+
+    EncodedFrame frame = encoder.encode(slot, sink_stats);
+
+    // Data that does not reach the top bit is marked through MaxSampleValue
+    int max_bits = format.significant_bits + format.bit_shift;
+    int significant_bits = format.significant_bits > 0 && max_bits < 16 ? max_bits : 0;
+
+    if(frame.strips){
+        int rows_per_strip = format.compression.rows_per_strip > 0 ? format.compression.rows_per_strip : slot.image.rows;
+        WriteStripsImage(*frame.strips, slot.image.cols, slot.image.rows, rows_per_strip,
+            frame.bits_per_sample, format.packed10 ? 0 : significant_bits, format.compression.codec,
+            format.compression.predictor && frame.bits_per_sample == 16, img_path.c_str());
+    } else if(format.packed10){
+        WritePacked10Image(frame.data, slot.image.cols, slot.image.rows, img_path.c_str());
+    } else {
+        WriteImage(slot.image, img_path.c_str(), significant_bits);
+    }
+}
+
+
+
+ContainerFrameSink::ContainerFrameSink(const fs::path &file, int width, int height, int cv_type, const SinkFormat &format) :
+    FrameSink(format),
+    container(file.string(), width, height, cv_type, format.significant_bits, format.bit_shift,
+              format.packed10 ? CONTAINER_PIXELS_PACKED10 : CONTAINER_PIXELS_RAW, format.io)
+{
+    const CompressionConfig &c = format.compression;
+    container.set_compression((uint32_t)c.codec, c.rows_per_strip, c.predictor && !format.packed10);
+}
+
+void ContainerFrameSink::write(FrameSlot &slot){
+    EncodedFrame frame = encoder.encode(slot, sink_stats);
+
+    if(!frame.strips){
+        container.write(slot.meta, frame.data, frame.bytes);
+        return;
+    }
+
+    // [strip count][strip sizes][strips]
+    thread_local std::vector<uint8_t> payload;
+    uint32_t n_strips = frame.strips->size();
+    size_t bytes = sizeof(uint32_t) * (1 + n_strips);
+    for(const auto &strip : *frame.strips){
+        bytes += strip.size();
+    }
+    payload.resize(bytes);
+
+    uint32_t *table = (uint32_t*)payload.data();
+    uint8_t *out = payload.data() + sizeof(uint32_t) * (1 + n_strips);
+    table[0] = n_strips;
+    for(uint32_t s = 0; s < n_strips; s++){
+        const auto &strip = (*frame.strips)[s];
+        table[1 + s] = strip.size();
+        memcpy(out, strip.data(), strip.size());
+        out += strip.size();
+    }
+
+    container.write(slot.meta, payload.data(), payload.size());
+}
+
+void ContainerFrameSink::close(){
+    container.close();
+}
@@ -0,0 +1,70 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#include "frame_writer.hpp"
+
+#include <exception>
+#include <iostream>
+
+
+void FrameWriter::start(Sink new_sink){
+    sink = new_sink;
+    written = 0;
+    errors = 0;
+
+    ring.open();
+
+    for(int i = 0; i < n_threads; i++){
+        threads.emplace_back(&FrameWriter::run, this);
+    }
+}
+
+
+void FrameWriter::stop(){
+    if(threads.empty()){
+        return;
+    }
+
+    ring.close();
+
+    for(auto &t : threads){
+        if(t.joinable()){
+            t.join();
+        }
+    }
+    threads.clear();
+}
+
+
+void FrameWriter::run(){
+    while(FrameSlot *slot = ring.pop()){
+        try {
+            sink(*slot);
+            written++;
+        } catch(const char* err) {
+            std::cerr << "Frame " << slot->meta.frame_id << ": " << err << std::endl;
+            errors++;
+        } catch(const std::exception &e) {
+            // filesystem_error from the TIFF sink, bad_alloc from the encoders
+            std::cerr << "Frame " << slot->meta.frame_id << ": " << e.what() << std::endl;
+            errors++;
+        } catch(...) {
+            std::cerr << "Frame " << slot->meta.frame_id << ": unknown error" << std::endl;
+            errors++;
+        }
+
+        // Always, a slot that is not released keeps its lease and its place in the ring
+        ring.release(slot);
+    }
+}
@@ -0,0 +1,178 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "hot_pixels.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+
+void HotPixelCounter::clear(){
+    std::fill(counts.begin(), counts.end(), 0);
+    events = 0;
+}
+
+
+// Smallest value v such that more than half of the samples in the histogram are <= v
+static uint32_t histogram_median(const std::vector<uint64_t> &histogram, uint64_t n){
+    uint64_t seen = 0;
+    for(size_t v = 0; v < histogram.size(); v++){
+        seen += histogram[v];
+        if(seen * 2 > n){
+            return v;
+        }
+    }
+    return histogram.size() - 1;
+}
+
+
+std::vector<HotPixel> HotPixelCounter::rank(double threshold, size_t max_pixels) const {
+    std::vector<HotPixel> hot;
+    if(counts.empty() || events == 0){
+        return hot;
+    }
+
+    std::vector<uint64_t> histogram(UINT16_MAX + 1, 0);
+    for(uint16_t c : counts){
+        histogram[c]++;
+    }
+    uint32_t median = histogram_median(histogram, counts.size());
+
+    std::vector<uint64_t> deviations(UINT16_MAX + 1, 0);
+    for(size_t v = 0; v < histogram.size(); v++){
+        deviations[v > median ? v - median : median - v] += histogram[v];
+    }
+    uint32_t mad = histogram_median(deviations, counts.size());
+
+    // Mostly silent sensors have a MAD of 0, one event of spread keeps the score finite
+    double sigma = 1.4826 * std::max<uint32_t>(mad, 1);
+
+    for(int y = 0; y < height; y++){
+        for(int x = 0; x < width; x++){
+            uint32_t c = counts[y * width + x];
+            if(c <= median){
+                continue;
+            }
+            double score = (c - median) / sigma;
+            if(score >= threshold){
+                hot.push_back(HotPixel{PixelCoordinates{(uint16_t)x, (uint16_t)y}, c, score});
+            }
+        }
+    }
+
+    std::sort(hot.begin(), hot.end(), [](const HotPixel &a, const HotPixel &b) {
+        return a.count > b.count;
+    });
+    if(hot.size() > max_pixels){
+        hot.resize(max_pixels);
+    }
+    return hot;
+}
+
+
+
+void write_crazy_pixels(const std::string &config_file, const std::string &section,
+                        const std::vector<PixelCoordinates> &pixels){
+    static std::mutex file_mutex;
+    std::lock_guard<std::mutex> lock(file_mutex);
+
+    std::ifstream in(config_file);
+    if(!in){
+        std::cerr << "Cannot read " << config_file << std::endl;
+        throw "Reading config file";
+    }
+    std::vector<std::string> lines;
+    for(std::string line; std::getline(in, line);){
+        lines.push_back(line);
+    }
+    in.close();
+
+    auto indent_of = [](const std::string &line) {
+        return line.find_first_not_of(' ');
+    };
+
+    // Find the section and the extent of its block
+    size_t begin = lines.size();
+    for(size_t i = 0; i < lines.size(); i++){
+        if(lines[i].rfind(section + ":", 0) == 0){
+            begin = i;
+            break;
+        }
+    }
+    if(begin == lines.size()){
+        std::cerr << "No " << section << " section in " << config_file << std::endl;
+        throw "Config section not found";
+    }
+    size_t end = begin + 1;
+    while(end < lines.size() && (lines[end].empty() || indent_of(lines[end]) > 0)){
+        end++;
+    }
+
+    std::vector<std::string> block;
+    std::string child = "  ";
+    for(size_t i = begin + 1; i < end; i++){
+        if(!lines[i].empty() && indent_of(lines[i]) != std::string::npos){
+            child = lines[i].substr(0, indent_of(lines[i]));
+            break;
+        }
+    }
+    block.push_back(child + "crazy_pixels:");
+    for(const PixelCoordinates &p : pixels){
+        block.push_back(child + "- " + std::to_string(p.x) + " " + std::to_string(p.y));
+    }
+
+    // Replace an existing key and its list items, or add the key at the end of the section
+    size_t key = end;
+    for(size_t i = begin + 1; i < end; i++){
+        if(lines[i].rfind(child + "crazy_pixels:", 0) == 0){
+            key = i;
+            break;
+        }
+    }
+    size_t key_end = key;
+    if(key < end){
+        key_end = key + 1;
+        while(key_end < end && (lines[key_end].rfind(child + "- ", 0) == 0 || indent_of(lines[key_end]) > child.size())){
+            key_end++;
+        }
+    } else {
+        // Before trailing blank lines of the section
+        while(key > begin + 1 && lines[key - 1].empty()){
+            key--;
+        }
+        key_end = key;
+    }
+
+    lines.erase(lines.begin() + key, lines.begin() + key_end);
+    lines.insert(lines.begin() + key, block.begin(), block.end());
+
+    std::string tmp = config_file + ".tmp";
+    {
+        std::ofstream out(tmp);
+        for(const std::string &line : lines){
+            out << line << "\n";
+        }
+        if(!out){
+            throw "Writing config file";
+        }
+    }
+    if(std::rename(tmp.c_str(), config_file.c_str()) != 0){
+        throw "Replacing config file";
+    }
+}
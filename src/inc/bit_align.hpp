@@ -0,0 +1,44 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// Ximea RAW16 carries 10 significant bits in the LSBs of every 16-bit word
+static const int XIMEA_SIGNIFICANT_BITS = 10;
+static const int XIMEA_MSB_SHIFT = 16 - XIMEA_SIGNIFICANT_BITS;
+
+
+typedef void (*ShiftFn)(const uint16_t *src, uint16_t *dst, size_t n, int shift);
+
+struct ShiftKernel {
+    const char *name;
+    ShiftFn fn;
+};
+
+// Fastest kernel supported by the running CPU, resolved once
+const ShiftKernel& best_shift_kernel();
+
+// Every kernel the running CPU supports, for benchmarking
+std::vector<ShiftKernel> available_shift_kernels();
+
+
+// dst[i] = src[i] << shift. Works in place (src == dst), never allocates.
+inline void shift_left_u16(const uint16_t *src, uint16_t *dst, size_t n, int shift){
+    best_shift_kernel().fn(src, dst, n, shift);
+}
@@ -0,0 +1,157 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+struct ClockSync_config {
+    bool enabled = true;
+    std::string camera = "ev_right";    // Prophesee camera whose trigger input sees the Ximea GPO
+    std::string ximea = "ximea";        // Ximea driving the GPO
+    int start_polarity = 1;             // Trigger polarity of the exposure start edge
+    int tolerance_us = 1000;            // Largest distance between a predicted and a matched edge
+    int fit_pairs = 512;                // Matched frames in the sliding clock fit
+    int acquire_frames = 16;            // Frames matched before the clock is trusted
+};
+
+
+/*
+ * Per-frame exposure times in event camera time (ximea_event_time.bin)
+ *
+ *   [ClockTableHeader]
+ *   [ClockTableRecord] x frames, in frame order
+ */
+
+static const char CLOCK_TABLE_MAGIC[8] = {'P', 'X', 'C', 'L', 'O', 'C', 'K', 0};
+static const uint32_t CLOCK_TABLE_VERSION = 1;
+
+// ClockTableRecord::flags
+static const uint32_t CLOCK_MATCHED = 1;        // Start (and end) come from trigger edges
+static const uint32_t CLOCK_PREDICTED = 2;      // No edge matched, times come from the clock model
+static const uint32_t CLOCK_END_EDGE = 4;       // The end edge was seen too
+
+#pragma pack(push, 1)
+
+struct ClockTableHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+struct ClockTableRecord {
+    int32_t frame_id;
+    uint32_t flags;             // 0 when the clock was not locked, start and end are then -1
+    int64_t ximea_ts_us;
+    int64_t start_us;           // Exposure start in event camera time
+    int64_t end_us;
+};
+
+#pragma pack(pop)
+
+
+
+// Maps the Ximea clock onto the clock of a Prophesee camera. The Ximea GPO is high while a frame
+// is exposed and drives the camera's trigger input, so every frame shows up as a pair of trigger
+// edges. The first acquire_frames frames are matched to edges by trying every plausible pairing:
+// the one that matches the most frames wins, ties go to the closer exposure lengths and then to
+// the host arrival times. From there on each frame's start edge is predicted with the linear fit
+// event_t = ximea_t + offset + drift * (ximea_t - x0) over the last fit_pairs matches, and looked
+// up within tolerance_us.
+//
+// add_frame() and add_trigger() may be called from different threads. They only queue what they
+// are given, matching and the table writes run on a worker thread for as long as the session lasts.
+class ClockSync {
+public:
+    ClockSync(const ClockSync_config &config) : config(config), table(nullptr) {}
+    ~ClockSync();
+
+    void start_session(const std::string &path);
+    void end_session();
+
+    void add_frame(int32_t frame_id, int64_t ximea_ts_us, uint32_t exposure_us, int64_t host_us);
+    void add_trigger(int64_t t_us, int polarity, int64_t host_us);
+
+    struct Model {
+        bool locked = false;
+        double offset_us = 0;   // event_t - ximea_t at ximea_t = x0
+        double x0 = 0;
+        double drift = 0;       // Relative rate, 1e-6 is 1 ppm
+        double rms_us = 0;
+        size_t pairs = 0;
+    };
+    Model model();
+
+private:
+    struct Edge {
+        int64_t start;
+        int64_t end;            // -1 until the end edge arrives
+        int64_t host;
+    };
+    struct Frame {
+        int32_t frame_id;
+        int64_t ts;
+        uint32_t exposure;
+        int64_t host;
+    };
+    struct Trigger {
+        int64_t t;
+        int polarity;
+        int64_t host;
+    };
+
+    const ClockSync_config &config;
+
+    // Handed from the capture threads to the worker
+    std::mutex input_mutex;
+    std::condition_variable input_ready;
+    std::vector<Frame> new_frames;
+    std::vector<Trigger> new_triggers;
+    bool accepting = false;
+    bool closing = false;
+    std::thread worker;
+
+    // Matching state, owned by the worker while the session runs
+    std::mutex mutex;
+    FILE *table;
+    std::string session_path;
+    std::deque<Frame> frames;
+    std::deque<Edge> edges;
+    std::deque<std::pair<int64_t, int64_t>> pairs;      // (ximea_ts, event start)
+    Model fit;
+    int misses = 0;
+    uint64_t matched = 0, predicted = 0, unlocked = 0;
+
+    void run();
+    void process(const std::vector<Trigger> &triggers, const std::vector<Frame> &arrived);
+    void acquire();
+    void resolve(bool flush);
+    void refit();
+    double predict(int64_t ximea_ts) const;
+    static std::deque<Edge>::iterator nearest_edge(std::deque<Edge>::iterator begin, std::deque<Edge>::iterator end, double t);
+    void write(const Frame &frame, uint32_t flags, int64_t start, int64_t end);
+};
+
+
+// ximea_event_time.bin -> CSV, for prophexi_export
+void clock_table_to_csv(const std::string &bin_path, const std::string &csv_path);
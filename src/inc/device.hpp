@@ -20,14 +20,28 @@
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <vector>
 #include <opencv2/core.hpp> 
 
+#include "mailbox.hpp"
+#include "thread_placement.hpp"
+#include "session_barrier.hpp"
+#include "metrics.hpp"
 
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
 
 
+// What a device reports to the StorageController
+struct StorageStatus {
+    size_t queue_depth = 0;         // Frames waiting for or being written
+    size_t queue_capacity = 0;      // 0 when the device has no queue of its own
+    uint64_t bytes_written = 0;     // Since the recording started
+};
+
+
 
 class Device {
 
@@ -38,11 +52,44 @@ public:
         stop();
     }
 
+    // init() and the device thread run with the device's placement, the threads they create
+    // inherit it. So do stage() and arm(), which build the sinks and their writer threads on the
+    // caller's thread.
     void start() {
-        init();
+        auto begin = std::chrono::steady_clock::now();
+        {
+            ScopedPlacement scoped(placement, name());
+            init();
+
+            thread = std::thread(&Device::run, this);
+        }
+        init_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
 
-        thread = std::thread(&Device::run, this);
+    // run() signals readiness once the device streams
+    bool wait_ready(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready_condition.wait_for(lock, timeout, [this]() { return ready || stopped; });
+        return ready;
     }
+    bool is_ready() const { return ready; }
+    int64_t ready_time_us() const { return ready_us; }     // Host steady clock
+    double init_time_ms() const { return init_ms; }
+
+    // The device only starts streaming once these are ready, set before start()
+    void start_after(const std::vector<Device*> &devices) { dependencies = devices; }
+
+    // Prepares the outputs in a session directory staged ahead of time, see session_stager.hpp
+    void stage(fs::path path) {
+        ScopedPlacement scoped(placement, name(), false);
+        stage_recording(path);
+    }
+
+    // Devices register their metrics with labels device="<name>", set before start()
+    void set_metrics(MetricsRegistry *registry) { metrics = registry; }
+
+    // CPUs, real-time priority and NUMA node, set before start()
+    void set_placement(const ThreadPlacement_config &config) { placement = config; }
 
     void stop_recording() {
         std::unique_lock<std::mutex> lock(mutex);
@@ -51,17 +98,45 @@ public:
     }
 
     void start_recording(fs::path path) {
-        std::unique_lock<std::mutex> lock(mutex);
-        
-        prepare_recording(path);
+        arm(path, nullptr);
+    }
+
+    // The device opens its outputs and waits on the barrier before it starts capturing, see
+    // DeviceRegistry::start_recording(). Waits until run() has finished writing the last session.
+    void arm(fs::path path, SessionBarrier *barrier) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if(!drained){
+                printf("%s: waiting for the last session to be written\n", name());
+                drained_condition.wait(lock, [this]() { return drained || stopped; });
+            }
+        }
+
+        // run() stays idle until paused is cleared, the outputs are prepared without the mutex
+        {
+            ScopedPlacement scoped(placement, name(), false);
+            prepare_recording(path);
+        }
 
+        std::unique_lock<std::mutex> lock(mutex);
+        session_barrier = barrier;
+        capture_start_us = -1;
+        capture_end_us = -1;
+        drained = false;
         paused = false;
         condition.notify_one();
     }
+
+    // Host steady clock [us] when capture really began and when it was last known to run,
+    // -1 until then
+    int64_t capture_start() const { return capture_start_us; }
+    int64_t capture_end() const { return capture_end_us; }
     void stop() {
         std::unique_lock<std::mutex> lock(mutex);
         stopped = true;
         condition.notify_one();
+        ready_condition.notify_all();
+        drained_condition.notify_all();
         lock.unlock();
 
         if (thread.joinable()) {
@@ -70,11 +145,26 @@ public:
     }
 
 
-    cv::Mat get_output_frame() {
-        std::lock_guard<std::mutex> lock(frame_mutex);
-        return out_frame.clone();
+    // True when a newer preview was published since the last call. frame shares the mailbox
+    // buffer, it stays valid until the next call.
+    bool get_output_frame(cv::Mat &frame) {
+        return preview.read(frame);
     }
 
+    // Devices only render previews while a viewer is attached
+    void attach_viewer() { preview.attach(); }
+    void detach_viewer() { preview.detach(); }
+
+    virtual const char* name() const { return "device"; }
+
+    // Storage back-pressure, see storage_controller.hpp. The degradation steps return false
+    // when they do not apply to the device.
+    virtual StorageStatus storage_status() { return StorageStatus(); }
+    virtual bool throttle_preview(int interval) { preview_interval = interval; return true; }
+    virtual bool decimate(int /*factor*/) { return false; }
+    virtual bool scale_erc(double /*factor*/) { return false; }
+    virtual void reset_throttling() { preview_interval = 1; }
+
 protected:
     std::thread thread;
     std::mutex mutex;
@@ -82,8 +172,63 @@ protected:
     std::atomic_bool paused;
     std::atomic_bool stopped;
 
-    cv::Mat out_frame;
-    std::mutex frame_mutex;
+    Mailbox<cv::Mat> preview;
+    std::atomic<int> preview_interval{1};     // Publish every Nth preview
+
+    ThreadPlacement_config placement;
+
+    // Without a registry the metrics are still updated, nobody reads them
+    MetricsRegistry unexported_metrics;
+    MetricsRegistry *metrics = &unexported_metrics;
+    std::string metric_labels() const { return std::string("device=\"") + name() + "\""; }
+
+    // Startup handshake, ready_condition is separate so waiting devices never take the run() wake-ups
+    std::condition_variable ready_condition;
+    std::atomic_bool ready{false};
+    std::atomic<int64_t> ready_us{-1};
+    std::atomic<double> init_ms{0};
+    std::vector<Device*> dependencies;
+
+    void mark_ready() {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready_us = host_now_us();
+        ready = true;
+        ready_condition.notify_all();
+    }
+    void wait_for_dependencies() {
+        for(Device *device : dependencies){
+            if(!device->wait_ready(std::chrono::seconds(10))){
+                std::cerr << name() << ": " << device->name() << " not ready after 10 s, starting anyway" << std::endl;
+            }
+        }
+    }
+
+    std::atomic<SessionBarrier*> session_barrier{nullptr};
+    std::atomic<int64_t> capture_start_us{-1};
+    std::atomic<int64_t> capture_end_us{-1};
+
+    // run() calls these with its outputs open, right after capture started and right before it stops.
+    // wait_for_commit() is false when the session was aborted.
+    bool wait_for_commit() {
+        SessionBarrier *barrier = session_barrier;
+        return barrier ? barrier->arrive_and_wait() : true;
+    }
+    static int64_t host_now_us() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    void mark_capture_start() { capture_start_us = host_now_us(); }
+    void mark_capture_end() { capture_end_us = host_now_us(); }
+
+    // run() calls this without the mutex once every output of the session is closed, also when the
+    // session was aborted. Capture may end well before that while writers drain their queues.
+    std::condition_variable drained_condition;
+    bool drained = true;
+    void mark_drained() {
+        std::lock_guard<std::mutex> lock(mutex);
+        drained = true;
+        drained_condition.notify_all();
+    }
 
     std::string path_root;
     std::string record_dir;
@@ -99,7 +244,12 @@ protected:
 
     virtual void init() = 0;
     virtual void run() = 0;
+    // Called by arm() without the mutex while run() waits for the session
     virtual void prepare_recording(fs::path path) = 0;
+    // Runs on the stager's thread without the device mutex, while the device is not recording. It
+    // may overlap with run() draining the last session; SessionStager::take() returns only after
+    // it finished, so prepare_recording() sees what it staged.
+    virtual void stage_recording(fs::path /*path*/) {}
      
     /*
     void run() {
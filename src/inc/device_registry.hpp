@@ -0,0 +1,126 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#pragma once
+
+#include "device.hpp"
+#include "ximea.hpp"
+#include "prophesee.hpp"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <yaml-cpp/yaml.h>
+
+
+enum class DeviceType {
+    XIMEA,
+    PROPHESEE,
+};
+
+DeviceType device_type_from_string(const std::string &s);
+
+
+struct Session_config {
+    int arm_timeout_ms = 5000;      // Devices not armed by then abort the session
+    int max_skew_us = 2000;         // Start or stop skew above this is reported as a warning
+};
+
+
+// One entry of the devices: list. The settings come from the top-level section of the same
+// name unless section says otherwise, name prefixes the device's recording files.
+struct DeviceEntry {
+    std::string name;
+    DeviceType type;
+    std::string section;
+
+    std::unique_ptr<Ximea_config> ximea_config;
+    std::unique_ptr<Prophesee_config> prophesee_config;
+    std::unique_ptr<Ximea> ximea;
+    std::unique_ptr<Prophesee> prophesee;
+
+    ThreadPlacement_config placement;       // placement: in the section
+
+    Device* device() const;
+    bool master() const { return prophesee_config && prophesee_config->master; }
+};
+
+
+// Creates the devices listed in the config and initializes them in parallel, slave event cameras
+// stream before their master. Without a devices: list the rig is one Ximea and
+// the ev_left and ev_right cameras.
+//
+//   devices:
+//     - {name: ximea, type: ximea}
+//     - {name: left, type: prophesee, section: ev_left}
+//     - {name: right, type: prophesee, section: ev_right}
+//
+// Recording starts in two phases: every device opens its outputs and arms, one commit then
+// releases them all. Each device marks when its capture really started and ended, the skews are
+// printed and written to session_sync.csv in the recording.
+//
+// Thread and buffer budgets are the settings of each section (writer_threads, compress_threads,
+// ring_slots, acq_buffer_size_mb, event_queue, representations.threads), print_budgets() sums
+// them up. A placement: block in the section pins the device's threads, see thread_placement.hpp.
+class DeviceRegistry {
+public:
+    // The command line fills the defaults of the Ximeas and of ev_right and ev_left, any other
+    // event camera starts from the ev_left defaults without serial, biases or ROI
+    DeviceRegistry(const Ximea_config &ximea_defaults, const Prophesee_config &right_defaults,
+                   const Prophesee_config &left_defaults);
+
+    void load(const std::string &config_file, const YAML::Node &config);
+    void create();
+
+    // In creation order, for the UI and the StorageController
+    std::vector<Device*>& devices() { return device_list; }
+
+    std::vector<Ximea_config*> ximea_configs();
+    std::vector<Prophesee_config*> prophesee_configs();
+
+    // By device name or config section, nullptr when there is no such device of that type
+    Ximea* find_ximea(const std::string &name);
+    Prophesee* find_prophesee(const std::string &name);
+
+    void start();
+    bool start_recording(const fs::path &path);     // False when not every device armed in time
+    void stop_recording();
+    void stop();
+
+    void print_budgets();
+
+    // Hands the registry to every device and polls their storage_status(), call before start()
+    void register_metrics(MetricsRegistry &metrics);
+
+private:
+    Ximea_config ximea_defaults;
+    std::map<std::string, Prophesee_config> prophesee_defaults;
+
+    std::vector<std::unique_ptr<DeviceEntry>> entries;
+    std::vector<Device*> device_list;
+
+    Session_config session_config;
+    SessionBarrier barrier;
+    fs::path session_path;
+
+    DeviceEntry* find(const std::string &name, DeviceType type);
+    void wait_for_marks(bool start);
+    void report_skew(bool start);
+    void write_session_sync();
+    void add(const std::string &name, DeviceType type, const std::string &section, const std::string &config_file,
+             const YAML::Node &config);
+};
@@ -0,0 +1,53 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+
+struct ErcControl_config {
+    bool enabled = false;
+    double min_mev = 5;             // Bounds of the ERC rate [Mev/s]
+    double max_mev = 200;
+    double high = 0.9;              // Output above high * rate means ERC is dropping events, raise it
+    double low = 0.4;               // Output below low * rate is a quiet scene, lower it
+    double step = 1.5;              // Largest change per adjustment
+    int interval_ms = 500;
+    int hold_ms = 2000;             // Minimum time between two changes
+    double max_write_mb_s = 0;      // RAW file throughput budget, 0 disables
+};
+
+
+// Adjusts the ERC event rate of one camera from its measured output rate and the RAW writer
+// throughput. Between low and high the rate is left alone, so a steady scene does not make it
+// oscillate.
+class ErcController {
+public:
+    ErcController(const ErcControl_config &config) : config(config), last_change_s(-1e9) {}
+
+    // Called every interval with the current rate and an optional ceiling (0 for none).
+    // Returns the new rate and why, or current when nothing should change.
+    uint32_t update(double now_s, double measured_ev_s, double write_mb_s, uint32_t current, uint32_t ceiling,
+                    std::string &reason);
+
+    // A new recording starts from the configured rate without waiting for hold_ms
+    void reset() { last_change_s = -1e9; }
+
+private:
+    const ErcControl_config &config;
+    double last_change_s;
+};
@@ -0,0 +1,195 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+
+// Bounded single producer / single consumer ring of reusable slots. The producer fills the slot
+// returned by claim() and hands it over with push(), the consumer reads front() and releases it
+// with pop(). Slots are never destroyed, so buffers inside them stop allocating once warm.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : head(0), tail_cache(0), tail(0), head_cache(0) {
+        size_t n = 1;
+        while(n < capacity){
+            n <<= 1;
+        }
+        slots.resize(n);
+        mask = n - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer side, nullptr when the queue is full
+    T* claim() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h - tail_cache > mask){
+            tail_cache = tail.load(std::memory_order_acquire);
+            if(h - tail_cache > mask){
+                return nullptr;
+            }
+        }
+        return &slots[h & mask];
+    }
+
+    void push() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // Consumer side, nullptr when the queue is empty
+    T* front() {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t == head_cache){
+            head_cache = head.load(std::memory_order_acquire);
+            if(t == head_cache){
+                return nullptr;
+            }
+        }
+        return &slots[t & mask];
+    }
+
+    void pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    size_t capacity() const { return slots.size(); }
+
+    // Direct slot access for preallocation, before the queue is shared
+    T& slot(size_t i) { return slots[i]; }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    // Each side keeps a stale copy of the other's index to avoid touching its cache line
+    alignas(64) std::atomic<size_t> head;
+    size_t tail_cache;
+    alignas(64) std::atomic<size_t> tail;
+    size_t head_cache;
+};
+
+
+
+// Durations of a callback, recorded by the callback's thread and readable from any other
+class LatencyStats {
+public:
+    LatencyStats();
+
+    struct Summary {
+        uint64_t count;
+        double mean_us;
+        double p99_us;
+        double max_us;
+    };
+
+    // Only from the recording thread
+    void add(uint64_t ns);
+
+    // The recording thread clears the counters at its next add()
+    void reset() { reset_requested = true; }
+
+    Summary summary() const;
+
+private:
+    static const int BUCKETS = 40;  // Powers of two of nanoseconds
+
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> max_ns;
+    std::atomic<bool> reset_requested;
+};
+
+
+
+// Hands event buffers from an SDK callback to a processing thread. push() copies the events into
+// a preallocated chunk and returns, it never takes a lock unless the consumer went to sleep on an
+// empty queue. When the consumer falls behind by the whole queue the buffer is dropped and counted.
+template <typename Event>
+class EventQueue {
+public:
+    EventQueue(size_t chunks, size_t chunk_events) : queue(chunks), sleeping(false), woken(false),
+                                                     dropped_chunks(0), dropped_events(0) {
+        for(size_t i = 0; i < queue.capacity(); i++){
+            queue.slot(i).reserve(chunk_events);
+        }
+    }
+
+    // Producer
+    bool push(const Event *begin, const Event *end) {
+        std::vector<Event> *chunk = queue.claim();
+        if(!chunk){
+            dropped_chunks.fetch_add(1, std::memory_order_relaxed);
+            dropped_events.fetch_add(end - begin, std::memory_order_relaxed);
+            return false;
+        }
+        chunk->assign(begin, end);
+        queue.push();
+
+        // Pairs with the fence in wait(), either the consumer sees the chunk or we see it sleeping
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(sleeping.load(std::memory_order_relaxed)){
+            // Taking the mutex closes the gap between the consumer's check and its wait,
+            // notifying after releasing it saves the woken consumer from blocking on it
+            { std::lock_guard<std::mutex> lock(mutex); }
+            condition.notify_one();
+        }
+        return true;
+    }
+
+    // Consumer, nullptr when empty. The chunk stays valid until pop().
+    const std::vector<Event>* front() { return queue.front(); }
+    void pop() { queue.pop(); }
+
+    // Consumer, sleeps until a chunk is queued, wake() is called or the timeout expires
+    void wait(std::chrono::milliseconds timeout) {
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait_for(lock, timeout, [this]() { return woken || queue.size() > 0; });
+        woken = false;
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    void wake() {
+        std::lock_guard<std::mutex> lock(mutex);
+        woken = true;
+        condition.notify_one();
+    }
+
+    size_t size() const { return queue.size(); }
+    size_t capacity() const { return queue.capacity(); }
+    uint64_t dropped() const { return dropped_chunks.load(std::memory_order_relaxed); }
+    uint64_t dropped_event_count() const { return dropped_events.load(std::memory_order_relaxed); }
+
+private:
+    SpscQueue<std::vector<Event>> queue;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::atomic<bool> sleeping;
+    bool woken;
+
+    std::atomic<uint64_t> dropped_chunks;
+    std::atomic<uint64_t> dropped_events;
+};
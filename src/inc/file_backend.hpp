@@ -0,0 +1,61 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+
+enum class IoBackend {
+    BUFFERED,       // pwrite through the page cache
+    DIRECT,         // O_DIRECT, aligned blocks written by a pool of pwrite threads
+    URING           // O_DIRECT, aligned blocks submitted through io_uring
+};
+
+IoBackend io_backend_from_string(const std::string &name);
+const char* io_backend_name(IoBackend backend);
+
+
+struct FileBackendConfig {
+    IoBackend backend = IoBackend::BUFFERED;
+    size_t block_bytes = 4 << 20;   // Size of one aligned O_DIRECT write
+    int queue_depth = 8;            // Blocks being filled or in flight
+    uint64_t preallocate = 0;       // fallocate() this many bytes up front, the file is trimmed on finish()
+};
+
+
+// Destination of a file that is written exactly once, in non overlapping pieces, possibly from several
+// threads at once. Every byte up to the final size has to be written, gaps are not allowed.
+class FileBackend {
+public:
+    virtual ~FileBackend() {}
+
+    // Falls back to DIRECT when io_uring is not available and to BUFFERED when the filesystem refuses O_DIRECT
+    static std::unique_ptr<FileBackend> open(const std::string &path, const FileBackendConfig &config);
+
+    virtual void write(const void *data, size_t size, uint64_t offset) = 0;
+
+    // Flushes what is still staged and trims the file to size
+    virtual void finish(uint64_t size) = 0;
+
+    virtual IoBackend backend() const = 0;
+};
+
+
+// Creates path with bytes allocated ahead of time, FileBackend::open() with the same preallocate
+// size then writes into it instead of truncating it
+void preallocate_file(const std::string &path, uint64_t bytes);
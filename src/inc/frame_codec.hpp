@@ -0,0 +1,69 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+
+enum class Codec : uint32_t {
+    NONE = 0,
+    DEFLATE = 1,    // zlib stream, TIFF COMPRESSION_ADOBE_DEFLATE
+    ZSTD = 2,       // TIFF COMPRESSION_ZSTD, needs PROPHEXI_HAVE_ZSTD
+    LZ4 = 3         // Container only, needs PROPHEXI_HAVE_LZ4
+};
+
+// Throws if the codec is unknown or was not compiled in
+Codec codec_from_string(const std::string &name);
+const char* codec_name(Codec codec);
+
+
+struct CompressionConfig {
+    Codec codec = Codec::NONE;
+    int level = 1;
+    int rows_per_strip = 64;
+    bool predictor = true;      // TIFF horizontal differencing, only applied to 16 bit samples
+    int threads = 4;
+};
+
+
+// Splits a frame into strips of rows and compresses them in parallel
+class StripCompressor {
+public:
+    StripCompressor(const CompressionConfig &config);
+
+    // strips is resized to the number of strips and every entry holds one compressed strip.
+    // Passing the same vector for every frame keeps it allocation free once warmed up.
+    void compress(const uint8_t *data, size_t row_bytes, int rows, int bits_per_sample,
+                  std::vector<std::vector<uint8_t>> &strips);
+
+    const CompressionConfig& settings() const { return config; }
+
+private:
+    CompressionConfig config;
+    ThreadPool pool;
+};
+
+
+// Returns the number of bytes written to dst
+size_t decompress_strip(Codec codec, const uint8_t *src, size_t src_bytes, uint8_t *dst, size_t dst_bytes);
+
+void apply_predictor16(const uint8_t *src, uint8_t *dst, size_t row_bytes, int rows);
+void undo_predictor16(uint8_t *data, size_t row_bytes, int rows);
@@ -0,0 +1,166 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "frame_ring.hpp"
+#include "file_backend.hpp"
+
+
+/*
+ * Append-only frame container (.pxf)
+ *
+ *   [ContainerHeader, CONTAINER_HEADER_SIZE bytes]
+ *   [ChunkHeader][payload][padding to CONTAINER_CHUNK_ALIGN]     x frames, in write order
+ *   [ContainerRecord] x frames, sorted by frame_id                 (index)
+ *   [ContainerFooter]
+ *
+ * Every chunk header repeats its index record, so a file without footer (crash, full disk)
+ * can still be read by scanning the chunks.
+ */
+
+static const char CONTAINER_MAGIC[8]   = {'P', 'X', 'F', 'R', 'A', 'M', 'E', 0};
+static const char CONTAINER_INDEX_MAGIC[8] = {'P', 'X', 'I', 'N', 'D', 'E', 'X', 0};
+static const uint32_t CONTAINER_CHUNK_MAGIC = 0x4b4e4843; // "CHNK"
+static const uint32_t CONTAINER_VERSION = 1;
+static const size_t CONTAINER_HEADER_SIZE = 4096;
+static const size_t CONTAINER_CHUNK_ALIGN = 64;
+
+// ContainerHeader::pixel_format
+static const uint32_t CONTAINER_PIXELS_RAW = 0;        // cv_type samples as in memory
+static const uint32_t CONTAINER_PIXELS_PACKED10 = 1;   // pack10.hpp layout, values without bit_shift
+
+
+#pragma pack(push, 1)
+
+struct ContainerHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t cv_type;
+    uint32_t frame_bytes;       // Size of one decoded frame
+    uint64_t created_us;        // Unix time of the recording start
+    uint32_t significant_bits;  // Bits of real data per sample
+    uint32_t bit_shift;         // How far the data was shifted left within each sample
+    uint32_t pixel_format;
+    uint32_t codec;             // Codec, compressed payloads are [strip count][strip sizes][strips]
+    uint32_t rows_per_strip;
+    uint32_t predictor;         // TIFF style horizontal differencing of 16 bit samples
+};
+
+struct ContainerRecord {
+    uint64_t offset;            // File offset of the payload
+    uint32_t payload_bytes;
+    int32_t frame_id;
+    int64_t ts_us;
+    uint32_t exposure_us;
+    float gain_db;
+    int32_t skipped_frames;
+    uint32_t reserved;
+};
+
+struct ChunkHeader {
+    uint32_t magic;
+    uint32_t reserved;
+    ContainerRecord record;
+    uint8_t padding[CONTAINER_CHUNK_ALIGN - 8 - sizeof(ContainerRecord)];
+};
+
+struct ContainerFooter {
+    char magic[8];
+    uint64_t index_offset;
+    uint64_t frame_count;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(ChunkHeader) == CONTAINER_CHUNK_ALIGN, "Chunk header must keep payloads aligned");
+
+
+
+// Writer side, write() may be called concurrently from the FrameWriter threads.
+// Every byte of the file is written exactly once, so any FileBackend can be used.
+class FrameContainerWriter {
+public:
+    FrameContainerWriter(const std::string &path, int width, int height, int cv_type, int significant_bits, int bit_shift,
+                         uint32_t pixel_format = CONTAINER_PIXELS_RAW, const FileBackendConfig &io = FileBackendConfig());
+    ~FrameContainerWriter();
+
+    // Before the first write()
+    void set_compression(uint32_t codec, uint32_t rows_per_strip, bool predictor);
+
+    void write(const FrameMeta &meta, const void *payload, size_t payload_bytes);
+
+    // Writes the index and footer
+    void close();
+
+    uint64_t bytes_written();
+
+    IoBackend backend() const { return file->backend(); }
+
+private:
+    std::mutex mutex;
+    std::unique_ptr<FileBackend> file;
+    bool closed;
+    bool header_written;
+    uint8_t header_block[CONTAINER_HEADER_SIZE];
+    uint64_t end_offset;
+    std::vector<ContainerRecord> index;
+};
+
+
+
+// Read-only view of a container through mmap
+class FrameContainerReader {
+public:
+    FrameContainerReader(const std::string &path);
+    ~FrameContainerReader();
+
+    FrameContainerReader(const FrameContainerReader&) = delete;
+    FrameContainerReader& operator=(const FrameContainerReader&) = delete;
+
+    const ContainerHeader& header() const { return *hdr; }
+    size_t size() const { return records.size(); }
+    const ContainerRecord& record(size_t i) const { return records[i]; }
+    const uint8_t* payload(size_t i) const { return base + records[i].offset; }
+
+    // Image header pointing into the mapping, no copy. Only for uncompressed CONTAINER_PIXELS_RAW.
+    cv::Mat image(size_t i) const;
+
+    // Frame i as it was handed to the writer, decompressing and unpacking if needed
+    void decode(size_t i, cv::Mat &out) const;
+
+    // False when the footer was missing and the index had to be rebuilt from the chunks
+    bool has_index() const { return indexed; }
+
+private:
+    int fd;
+    uint8_t *base;
+    size_t file_size;
+    const ContainerHeader *hdr;
+    std::vector<ContainerRecord> records;
+    bool indexed;
+
+    void scan_chunks();
+};
@@ -0,0 +1,87 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/*
+ * Binary per-frame metadata log (ximea_ts.bin)
+ *
+ *   [FrameLogHeader]
+ *   [FrameLogRecord] x frames, in acquisition order
+ *
+ * Records are fixed size, a log cut short by a crash is read up to its last complete record.
+ */
+
+static const char FRAME_LOG_MAGIC[8] = {'P', 'X', 'F', 'L', 'O', 'G', 0, 0};
+static const uint32_t FRAME_LOG_VERSION = 1;
+static const uint32_t FRAME_LOG_NO_SLOT = 0xffffffff;   // Frame was read into the scratch buffer and dropped
+
+
+#pragma pack(push, 1)
+
+struct FrameLogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+struct FrameLogRecord {
+    int32_t frame_id;
+    uint32_t slot;              // Ring slot the frame was written from
+    int64_t ts_us;              // Camera timestamp
+    int64_t host_us;            // steady_clock when the frame was returned by the driver
+    uint32_t exposure_us;
+    float gain_db;
+    int32_t skipped_frames;
+    uint32_t reserved;
+};
+
+#pragma pack(pop)
+
+
+// Single writer, records are copied into a buffer and written out one batch at a time
+class FrameLogWriter {
+public:
+    FrameLogWriter(const std::string &path, size_t batch_records = 256);
+    ~FrameLogWriter();
+
+    FrameLogWriter(const FrameLogWriter&) = delete;
+    FrameLogWriter& operator=(const FrameLogWriter&) = delete;
+
+    void append(const FrameLogRecord &record) {
+        buffer[count++] = record;
+        if(count == buffer.size()){
+            flush();
+        }
+    }
+
+    void flush();
+    void close();
+
+private:
+    int fd;
+    std::vector<FrameLogRecord> buffer;
+    size_t count;
+};
+
+
+std::vector<FrameLogRecord> read_frame_log(const std::string &path);
+
+// Writes the log in the ximea_ts.csv layout recorded by earlier versions
+void frame_log_to_csv(const std::string &log_path, const std::string &csv_path);
@@ -0,0 +1,127 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include <opencv2/core.hpp>
+
+
+// What the producer does when every slot of the ring is taken
+enum class RingPolicy {
+    BLOCK,          // Wait for a writer to release a slot
+    DROP_OLDEST,    // Reuse the oldest frame that no writer has picked up yet
+    DROP_NEWEST     // Skip the incoming frame
+};
+
+RingPolicy ring_policy_from_string(const std::string &name);
+const char* ring_policy_name(RingPolicy policy);
+
+
+struct FrameMeta {
+    int frame_id;
+    long long ts_us;
+    unsigned int exposure_us;
+    float gain_db;
+    int skipped_frames;
+};
+
+
+struct FrameSlot {
+    cv::Mat image;      // Header over the ring's preallocated storage, or over a lent driver buffer
+    FrameMeta meta;
+    size_t index;
+    uint64_t lease;     // Non zero while image points to a driver buffer
+};
+
+
+struct RingStats {
+    size_t capacity;
+    size_t depth;           // Frames waiting for a writer
+    size_t in_flight;       // Frames currently held by writers
+    size_t high_water;      // Max depth since open()
+    uint64_t published;
+    uint64_t dropped_oldest;
+    uint64_t dropped_newest;
+    size_t leases;          // Driver buffers currently held by the ring
+};
+
+
+// Bounded ring of preallocated frames between the acquisition thread (single producer)
+// and the writer threads (consumers). No allocation happens after construction.
+class FrameRing {
+public:
+    FrameRing(size_t n_slots, int rows, int cols, int type, RingPolicy policy);
+    ~FrameRing();
+
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+
+    // Producer side. acquire() returns nullptr when the frame has to be dropped.
+    FrameSlot* acquire();
+    void publish(FrameSlot *slot);
+
+    // Consumer side. pop() blocks, returns nullptr once the ring is closed and drained.
+    FrameSlot* pop();
+    void release(FrameSlot *slot);
+
+    // Zero copy acquisition: the slot carries a buffer owned by the driver instead of its own storage.
+    // The lease id is increasing, release() hands the buffer back and restores the slot's storage.
+    void lend(FrameSlot *slot, void *buffer, uint64_t lease);
+
+    // Blocks until no buffer lent before the given lease is still held
+    void wait_leases(uint64_t oldest_allowed);
+
+    // open() resets the statistics for a new recording, close() lets the consumers drain and exit
+    void open();
+    void close();
+
+    RingStats stats();
+
+    // Frames queued or being written
+    size_t depth();
+    size_t capacity() const { return slots.size(); }
+
+    size_t frame_bytes() const { return slot_bytes; }
+
+private:
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::condition_variable lease_returned;
+
+    RingPolicy policy;
+    bool closed;
+
+    size_t slot_bytes;
+    int rows, cols, type;
+    uint8_t *storage;
+    std::vector<FrameSlot> slots;
+
+    std::vector<FrameSlot*> free_slots;     // Stack of unused slots
+    std::vector<FrameSlot*> queue;          // Circular FIFO of published slots
+    size_t queue_head;
+    size_t queue_count;
+    size_t in_flight;
+
+    size_t high_water;
+    uint64_t published;
+    uint64_t dropped_oldest;
+    uint64_t dropped_newest;
+};
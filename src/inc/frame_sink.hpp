@@ -0,0 +1,145 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include "frame_ring.hpp"
+#include "frame_container.hpp"
+#include "bit_align.hpp"
+#include "frame_codec.hpp"
+
+namespace fs = boost::filesystem;
+
+
+// significant_bits > 0 marks data that does not use the full sample depth (MaxSampleValue)
+void WriteImage(cv::Mat& image, const char* filename, int significant_bits = 0);
+
+// BitsPerSample=10 TIFF from a buffer laid out by pack10_image()
+void WritePacked10Image(const uint8_t *packed, int width, int height, const char* filename);
+
+// Strips compressed by StripCompressor, written raw (TIFFWriteRawStrip)
+void WriteStripsImage(const std::vector<std::vector<uint8_t>> &strips, int width, int height, int rows_per_strip,
+                      int bits_per_sample, int significant_bits, Codec codec, bool predictor, const char* filename);
+
+// Reads a BitsPerSample=10 TIFF back into CV_16UC1. With the default shift the result is identical
+// to the image WriteImage() stores for MSB aligned frames.
+void ReadPacked10Image(const char* filename, cv::Mat &image, int bit_shift = XIMEA_MSB_SHIFT);
+
+
+enum class SinkType {
+    TIFF,           // One frameNNNNNN.tif per frame
+    CONTAINER       // Single append-only .pxf file
+};
+
+SinkType sink_type_from_string(const std::string &name);
+
+
+// How the frames handed to a sink are laid out, and how they should be stored
+struct SinkFormat {
+    int significant_bits = 0;   // 0 when the data uses the full sample depth
+    int bit_shift = 0;          // Left shift already applied to the data within each sample
+    bool packed10 = false;      // Store 4 pixels in 5 bytes, see pack10.hpp
+    CompressionConfig compression;
+    FileBackendConfig io;       // Container sink only, TIFF frames go through libtiff
+};
+
+
+struct SinkStats {
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> raw_bytes{0};         // Frame bytes as handed to the sink
+    std::atomic<uint64_t> stored_bytes{0};      // After packing and compression
+    std::atomic<uint64_t> encode_ns{0};         // Packing and compression, summed over the writer threads
+
+    double ratio() const { return stored_bytes ? (double)raw_bytes / stored_bytes : 0.0; }
+    double encode_mb_per_s() const { return encode_ns ? raw_bytes * 1e3 / encode_ns : 0.0; }
+};
+
+void print_sink_stats(const char *name, const SinkFormat &format, const SinkStats &stats);
+
+
+// Stored representation of one frame
+struct EncodedFrame {
+    const uint8_t *data;        // Uncompressed stored layout (16 bit samples or packed10)
+    size_t bytes;
+    size_t row_bytes;
+    int rows;
+    int bits_per_sample;
+    const std::vector<std::vector<uint8_t>> *strips;   // Compressed strips, nullptr when not compressed
+};
+
+// Packs and compresses frames. The buffers behind an EncodedFrame belong to the calling
+// thread and stay valid until its next encode().
+class FrameEncoder {
+public:
+    FrameEncoder(const SinkFormat &format);
+
+    EncodedFrame encode(const FrameSlot &slot, SinkStats &stats);
+
+private:
+    SinkFormat format;
+    std::unique_ptr<StripCompressor> compressor;
+};
+
+
+// Destination of the recorded frames. write() is called concurrently from the writer threads.
+class FrameSink {
+public:
+    FrameSink(const SinkFormat &format) : format(format), encoder(format) {}
+    virtual ~FrameSink() {}
+
+    virtual void write(FrameSlot &slot) = 0;
+    virtual void close() {}
+
+    const SinkStats& stats() const { return sink_stats; }
+    const SinkFormat& sink_format() const { return format; }
+
+protected:
+    SinkFormat format;
+    FrameEncoder encoder;
+    SinkStats sink_stats;
+};
+
+
+class TiffFrameSink : public FrameSink {
+public:
+    TiffFrameSink(const fs::path &frames_path, const SinkFormat &format);
+
+    void write(FrameSlot &slot);
+
+private:
+    fs::path frames_path;
+};
+
+
+class ContainerFrameSink : public FrameSink {
+public:
+    ContainerFrameSink(const fs::path &file, int width, int height, int cv_type, const SinkFormat &format);
+
+    void write(FrameSlot &slot);
+    void close();
+
+    IoBackend backend() const { return container.backend(); }
+
+private:
+    FrameContainerWriter container;
+};
@@ -0,0 +1,55 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "frame_ring.hpp"
+
+
+// Pool of threads draining a FrameRing. Every frame popped from the ring is handed to
+// the sink and released back to the ring afterwards.
+class FrameWriter {
+public:
+    typedef std::function<void(FrameSlot&)> Sink;
+
+    FrameWriter(FrameRing &ring, int n_threads) : ring(ring), n_threads(n_threads), written(0), errors(0) {}
+
+    ~FrameWriter() {
+        stop();
+    }
+
+    void start(Sink sink);
+
+    // Closes the ring and returns once every queued frame was written
+    void stop();
+
+    uint64_t frames_written() const { return written; }
+    uint64_t write_errors() const { return errors; }
+
+private:
+    FrameRing &ring;
+    int n_threads;
+    Sink sink;
+    std::vector<std::thread> threads;
+
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> errors;
+
+    void run();
+};
@@ -0,0 +1,72 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+struct PixelCoordinates{
+    uint16_t x;
+    uint16_t y;
+};
+
+struct HotPixel {
+    PixelCoordinates pixel;
+    uint32_t count;
+    double score;       // Robust z-score, (count - median) / (1.4826 * MAD)
+};
+
+
+
+// Per-pixel event counts for hot pixel calibration. One saturating 16 bit counter per pixel in
+// row order, so a 1280x720 sensor fits in 1.8 MB and a buffer of events touches few cache lines.
+class HotPixelCounter {
+public:
+    HotPixelCounter(int width, int height) : width(width), height(height), counts(width * height, 0), events(0) {}
+
+    // Any event type with x and y, Metavision::EventCD in practice
+    template <typename Event>
+    void add(const Event *begin, const Event *end) {
+        for(const Event *ev = begin; ev != end; ++ev){
+            uint16_t &c = counts[ev->y * width + ev->x];
+            c += c != UINT16_MAX;
+        }
+        events += end - begin;
+    }
+
+    void clear();
+
+    uint64_t total() const { return events; }
+
+    // Pixels whose count is an outlier above threshold, best first, at most max_pixels of them.
+    // Median and MAD come from count histograms, the zero counts of silent pixels included.
+    std::vector<HotPixel> rank(double threshold, size_t max_pixels) const;
+
+private:
+    int width;
+    int height;
+    std::vector<uint16_t> counts;
+    uint64_t events;
+};
+
+
+
+// Replaces the crazy_pixels list of a top-level section of a YAML config in place. The file is
+// edited as text so its comments and layout survive. Serialized across threads.
+void write_crazy_pixels(const std::string &config_file, const std::string &section,
+                        const std::vector<PixelCoordinates> &pixels);
@@ -0,0 +1,97 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+
+// Triple buffered latest-value mailbox. The producer fills the back buffer and swaps it with
+// the middle one, the consumer swaps the middle one into the front when it is newer than what
+// it already has. Neither side waits for the other and nothing is copied on the way.
+//
+// One consumer. Producers are serialized by try_publish(), a producer that finds another one
+// busy skips its frame instead of blocking.
+template <typename T>
+class Mailbox {
+public:
+    Mailbox() : state(MIDDLE_INIT), back(BACK_INIT), front(FRONT_INIT), version(0), viewers(0) {}
+
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+
+    // Previews are only worth producing while someone looks at them
+    void attach() { viewers++; }
+    void detach() { viewers--; }
+    bool attached() const { return viewers > 0; }
+
+    // A published value that the consumer has not picked up yet
+    bool pending() const { return state.load(std::memory_order_relaxed) & FRESH; }
+
+    // Attached and the last value was consumed
+    bool wanted() const { return attached() && !pending(); }
+
+    // fill(T&) writes the new value into the back buffer, which keeps whatever it held
+    // three publishes ago so buffers can be reused without allocating
+    template <typename Fill>
+    bool try_publish(Fill fill) {
+        std::unique_lock<std::mutex> lock(producer, std::try_to_lock);
+        if(!lock.owns_lock()){
+            return false;
+        }
+
+        fill(buffers[back]);
+
+        version++;
+        uint64_t old = state.exchange((version << SEQ_SHIFT) | FRESH | back, std::memory_order_acq_rel);
+        back = old & INDEX;
+        return true;
+    }
+
+    // Returns false when nothing newer than the last read was published. Otherwise value refers to
+    // the consumer's buffer, which stays untouched by the producers until the next read().
+    bool read(T &value, uint64_t *seq = nullptr) {
+        uint64_t current = state.load(std::memory_order_relaxed);
+        do {
+            if(!(current & FRESH)){
+                return false;
+            }
+        } while(!state.compare_exchange_weak(current, (current & ~(INDEX | FRESH)) | front, std::memory_order_acq_rel));
+
+        front = current & INDEX;
+        if(seq){
+            *seq = current >> SEQ_SHIFT;
+        }
+        value = buffers[front];
+        return true;
+    }
+
+private:
+    static const uint64_t INDEX = 3;
+    static const uint64_t FRESH = 4;
+    static const int SEQ_SHIFT = 3;
+    static const uint64_t BACK_INIT = 0, MIDDLE_INIT = 1, FRONT_INIT = 2;
+
+    T buffers[3];
+
+    std::atomic<uint64_t> state;    // [version][fresh][middle index]
+    std::mutex producer;
+    uint64_t back;                  // Owned by the producer holding the mutex
+    uint64_t front;                 // Owned by the consumer
+    uint64_t version;
+
+    std::atomic<int> viewers;
+};
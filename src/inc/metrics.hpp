@@ -0,0 +1,143 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Metrics are updated with relaxed atomics from the capture threads, only registration and
+// rendering take the registry mutex
+
+class Counter {
+public:
+    void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value{0};
+};
+
+
+class Gauge {
+public:
+    void set(double v) { value.store(v, std::memory_order_relaxed); }
+    double get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<double> value{0};
+};
+
+
+// Fixed buckets, observe() is a short scan and two atomic adds
+class Histogram {
+public:
+    Histogram(const std::vector<double> &bounds);
+
+    void observe(double v);
+
+    const std::vector<double>& bounds() const { return upper_bounds; }
+    uint64_t bucket(size_t i) const { return counts[i].load(std::memory_order_relaxed); }    // Not cumulative
+    uint64_t count() const;
+    double sum() const { return total.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<double> upper_bounds;
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;    // One more than bounds, the last is +Inf
+    std::atomic<double> total{0};
+};
+
+
+// Write latencies [s]
+extern const std::vector<double> LATENCY_BUCKETS;
+
+
+// Metric families by name, every series of a family has its own labels (device="ximea").
+// References stay valid for the lifetime of the registry.
+class MetricsRegistry {
+public:
+    Counter& counter(const std::string &name, const std::string &help, const std::string &labels);
+    Gauge& gauge(const std::string &name, const std::string &help, const std::string &labels);
+    Histogram& histogram(const std::string &name, const std::string &help, const std::string &labels,
+                         const std::vector<double> &bounds = LATENCY_BUCKETS);
+
+    // Called before every render() to refresh gauges that are cheaper to poll than to update
+    void add_collector(std::function<void()> collector);
+
+    // Prometheus text exposition format 0.0.4
+    std::string render();
+
+private:
+    enum class Type { COUNTER, GAUGE, HISTOGRAM };
+
+    struct Series {
+        std::string labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+    struct Family {
+        std::string name;
+        std::string help;
+        Type type;
+        std::deque<Series> series;
+    };
+
+    std::mutex mutex;
+    std::deque<Family> families;
+    std::map<std::string, Family*> by_name;
+    std::vector<std::function<void()>> collectors;
+
+    Series& series(const std::string &name, const std::string &help, Type type, const std::string &labels);
+};
+
+
+struct Metrics_config {
+    bool enabled = true;
+    int port = 9464;                // HTTP on 127.0.0.1, 0 disables it
+    std::string unix_socket;        // Also served on this Unix socket when set
+};
+
+
+// Answers every request with the rendered registry, on localhost only. Scrapes never touch the
+// capture threads beyond reading their atomics.
+class MetricsServer {
+public:
+    MetricsServer(MetricsRegistry &registry, const Metrics_config &config);
+    ~MetricsServer();
+
+    void start();
+    void stop();
+
+private:
+    MetricsRegistry &registry;
+    const Metrics_config &config;
+
+    std::thread thread;
+    std::atomic_bool stopped{false};
+    std::vector<int> listeners;
+
+    void run();
+    void serve(int fd);
+};
@@ -0,0 +1,53 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/*
+ * 10 bit packing, 4 pixels in 5 bytes.
+ *
+ * Same bit order as TIFF BitsPerSample=10: samples are packed MSB first and every row starts
+ * on a byte boundary, so a packed row can be written as a TIFF strip unchanged.
+ *
+ *   byte 0: p0[9:2]   byte 1: p0[1:0] p1[9:4]   byte 2: p1[3:0] p2[9:6]   byte 3: p2[5:0] p3[9:8]   byte 4: p3[7:0]
+ */
+
+inline size_t packed10_row_bytes(size_t width){
+    return (width * 10 + 7) / 8;
+}
+
+// Packs one row: dst = (src >> bit_shift) & 0x3ff. dst needs packed10_row_bytes(n) bytes.
+typedef void (*Pack10Fn)(const uint16_t *src, uint8_t *dst, size_t n, int bit_shift);
+
+// Unpacks one row: dst = value << bit_shift
+typedef void (*Unpack10Fn)(const uint8_t *src, uint16_t *dst, size_t n, int bit_shift);
+
+struct Pack10Kernel {
+    const char *name;
+    Pack10Fn pack;
+    Unpack10Fn unpack;
+};
+
+const Pack10Kernel& best_pack10_kernel();
+std::vector<Pack10Kernel> available_pack10_kernels();
+
+
+// Whole images, src_step / dst_step are the row strides in bytes of the 16 bit image
+void pack10_image(const uint16_t *src, size_t src_step, uint8_t *dst, int width, int height, int bit_shift);
+void unpack10_image(const uint8_t *src, uint16_t *dst, size_t dst_step, int width, int height, int bit_shift);
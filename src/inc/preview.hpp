@@ -0,0 +1,54 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/*
+ * Preview debayer for the Ximea GBRG mosaic
+ *
+ *   G B G B ...
+ *   R G R G ...
+ *
+ * Every 2x2 cell becomes one BGR8 pixel (B, average of the two G, R), converted to 8 bit in the
+ * same pass. downscale averages downscale x downscale cells first, so the output is
+ * width / (2 * downscale) x height / (2 * downscale).
+ */
+
+// One output row: gb and rg are the two mosaic rows of n cells, bgr receives 3 * n bytes.
+// Samples are mapped to 8 bit by a rounding right shift.
+typedef void (*PreviewRowFn)(const uint16_t *gb, const uint16_t *rg, uint8_t *bgr, size_t n, int shift);
+
+struct PreviewKernel {
+    const char *name;
+    PreviewRowFn row;
+};
+
+const PreviewKernel& best_preview_kernel();
+std::vector<PreviewKernel> available_preview_kernels();
+
+
+inline int preview_size(int n, int downscale){
+    return n / (2 * downscale);
+}
+
+// src_step / dst_step are row strides in bytes. downscale is any factor from 1, rows and columns
+// that do not fill a whole cell are dropped.
+void preview_gbrg(const uint16_t *src, size_t src_step, int width, int height,
+                  uint8_t *dst, size_t dst_step, int downscale, int shift,
+                  const PreviewKernel &kernel = best_preview_kernel());
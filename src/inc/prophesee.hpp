@@ -15,6 +15,12 @@
 #pragma once
 
 #include "device.hpp"
+#include "event_queue.hpp"
+#include "hot_pixels.hpp"
+#include "erc_controller.hpp"
+#include "representations.hpp"
+#include "raw_index.hpp"
+#include "clock_sync.hpp"
 #include <vector>
 
 
@@ -33,19 +39,26 @@
 
 namespace fs = boost::filesystem;
 
-struct PixelCoordinates{
-    uint16_t x;
-    uint16_t y;
-};
-
 struct Prophesee_config{
     std::string serial;
+    std::string output_name;        // <name>.raw and <name>_erc.csv, empty uses right or left
     std::string biases_file;
     std::vector<uint16_t> roi;
     bool master;
     bool erc;
     uint32_t erc_rate;
+    ErcControl_config erc_control;
+    Representation_config representations;
+    int64_t raw_index_interval_us = 10000;  // Seek index next to the RAW file, 0 disables
     std::vector<PixelCoordinates> crazy_pixels;
+    uint32_t event_queue = 256;     // CD buffers queued between the SDK callback and the preview thread
+
+    // Hot pixel calibration, see calibrate_hot_pixels()
+    double hot_pixel_calibration_s = 0;
+    double hot_pixel_threshold = 10;
+    bool hot_pixel_write_back = true;
+    std::string config_file;        // Where crazy_pixels came from
+    std::string config_section;
 };
 
 
@@ -55,16 +68,48 @@ class Prophesee : public Device {
 public:
     Prophesee(Prophesee_config &config):  Device(), config(config) {}
 
+    const char* name() const {
+        if(!config.output_name.empty()){
+            return config.output_name.c_str();
+        }
+        return config.master ? "right" : "left";
+    }
+
+    StorageStatus storage_status();
+    bool scale_erc(double factor);
+    void reset_throttling();
+
+    // Live time surfaces, histograms and voxel grids, nullptr unless enabled in the config
+    RepresentationEngine* representations() { return representation_engine.get(); }
+
+    // Trigger edges are handed to the clock, set before start()
+    void set_clock_sync(ClockSync *clock) { clock_sync = clock; }
 
 private:
     Prophesee_config &config;
     Metavision::Camera camera;
+    ClockSync *clock_sync = nullptr;
+
+    std::mutex erc_mutex;
+    uint32_t erc_current = 0;   // ERC rate applied to the sensor
+    uint32_t erc_ceiling = 0;   // Set by the StorageController, 0 otherwise
+
+    LatencyStats cd_callback_latency;
+
+    size_t mask_capacity = 0;
+
+    std::unique_ptr<RepresentationEngine> representation_engine;
+    std::unique_ptr<RawIndexer> raw_indexer;
 
     fs::path biases_output;
 
     void init();
     void run();
     void prepare_recording(fs::path path);
+    void report_callback_latency(uint64_t dropped);
+    void set_erc_rate(uint32_t rate);
+    void apply_pixel_masks();
+    void calibrate_hot_pixels(const HotPixelCounter &counter);
 
 };
 
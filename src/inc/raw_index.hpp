@@ -0,0 +1,200 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/*
+ * Seek index for Prophesee RAW recordings (<file>.raw.idx)
+ *
+ *   [RawIndexHeader]
+ *   [RawIndexEntry] x entries, in file order
+ *
+ * Each entry points at a TIME_HIGH word of the event stream, the first one at or after a multiple
+ * of interval_us. Decoding can start at such a word with the time base of the entry and every
+ * event after it is at least entry.t_us. Times are the ones the SDK's decoder reports for the
+ * file, unwrapped from the start of the recording. Entries are appended while recording, an
+ * index cut short is still valid up to its last complete entry.
+ */
+
+static const char RAW_INDEX_MAGIC[8] = {'P', 'X', 'R', 'A', 'W', 'I', 'D', 'X'};
+static const uint32_t RAW_INDEX_VERSION = 1;
+
+enum class RawFormat : uint32_t { UNKNOWN = 0, EVT2 = 2, EVT3 = 3 };
+
+
+#pragma pack(push, 1)
+
+struct RawIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t format;
+    uint64_t interval_us;
+    uint64_t data_offset;       // Start of the event stream, after the ASCII header
+    uint8_t reserved[32];
+};
+
+struct RawIndexEntry {
+    int64_t t_us;
+    uint64_t offset;            // File offset of the TIME_HIGH word
+};
+
+#pragma pack(pop)
+
+
+// Parsed ASCII header of a RAW file, data_offset 0 while it is incomplete
+struct RawHeader {
+    RawFormat format = RawFormat::UNKNOWN;
+    int width = 0;
+    int height = 0;
+    size_t data_offset = 0;
+};
+
+bool parse_raw_header(const uint8_t *data, size_t size, RawHeader &header);
+
+
+// Decoded CD event, same layout as Metavision::EventCD
+struct RawEvent {
+    uint16_t x;
+    uint16_t y;
+    int16_t p;
+    int64_t t;
+};
+
+
+// TIME_HIGH word candidates for the index
+struct TimeMark {
+    uint64_t offset;
+    uint32_t high;              // Raw TIME_HIGH value, before unwrapping
+};
+
+// Finds TIME_HIGH words and keeps the first one of each interval_us bucket. Buckets are taken from
+// the raw value, so chunks of a file can be scanned independently and in any order.
+class RawTimeScanner {
+public:
+    RawTimeScanner(RawFormat format, int64_t interval_us);
+
+    // data must start on a word boundary of the stream, a trailing partial word is ignored.
+    // Returns the bytes consumed.
+    size_t scan(const uint8_t *data, size_t size, uint64_t offset, std::vector<TimeMark> &marks);
+
+private:
+    RawFormat format;
+    int64_t interval_us;
+    int64_t last_bucket;
+};
+
+// Unwraps TimeMarks in file order into index entries
+class RawIndexBuilder {
+public:
+    RawIndexBuilder(RawFormat format, int64_t interval_us);
+
+    void add(const std::vector<TimeMark> &marks, std::vector<RawIndexEntry> &entries);
+
+private:
+    RawFormat format;
+    int64_t interval_us;
+    int64_t base;
+    int64_t last_t;
+    int64_t next_t;
+    bool started;
+};
+
+// Writes the whole index of a finished RAW file, scanning it with `threads` threads
+size_t build_raw_index(const std::string &raw_path, int64_t interval_us, int threads);
+
+std::string raw_index_path(const std::string &raw_path);
+
+
+
+// Builds the index of a RAW file while the SDK is still writing it
+class RawIndexer {
+public:
+    RawIndexer(int64_t interval_us, int poll_ms = 200) : interval_us(interval_us), poll_ms(poll_ms), running(false), unsupported(false) {}
+
+    ~RawIndexer() {
+        stop();
+    }
+
+    void start(const std::string &raw_path);
+
+    // Indexes whatever the file holds by now, call after the recording stopped
+    void stop();
+
+private:
+    int64_t interval_us;
+    int poll_ms;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running;
+
+    // Only touched by the indexer thread
+    bool unsupported;
+    std::string raw_path;
+    int raw_fd;
+    FILE *index;
+    RawHeader header;
+    uint64_t position;
+    std::unique_ptr<RawTimeScanner> scanner;
+    std::unique_ptr<RawIndexBuilder> builder;
+    std::vector<uint8_t> buffer;
+    std::vector<TimeMark> marks;
+    std::vector<RawIndexEntry> entries;
+
+    void run();
+    bool poll();
+    void close();
+};
+
+
+
+// Reads time windows of a RAW file through its index, mmap based
+class RawEventReader {
+public:
+    RawEventReader(const std::string &raw_path);
+    ~RawEventReader();
+
+    RawEventReader(const RawEventReader&) = delete;
+    RawEventReader& operator=(const RawEventReader&) = delete;
+
+    // Appends the CD events with t0 <= t < t1, decoding from the last index entry at or before t0
+    void read(int64_t t0, int64_t t1, std::vector<RawEvent> &events) const;
+
+    bool has_index() const { return !index.empty(); }
+    const RawHeader& header() const { return hdr; }
+    const std::vector<RawIndexEntry>& entries() const { return index; }
+
+    // Bytes decoded by the last read(), to check the seek
+    size_t last_decoded_bytes() const { return decoded_bytes; }
+
+private:
+    int fd;
+    uint8_t *base;
+    size_t file_size;
+    RawHeader hdr;
+    std::vector<RawIndexEntry> index;
+    mutable size_t decoded_bytes;
+};
@@ -0,0 +1,138 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "mailbox.hpp"
+#include "thread_pool.hpp"
+
+
+struct Representation_config {
+    bool enabled = false;
+    bool time_surface = true;
+    bool histogram = true;
+    bool voxel = true;
+    int window_us = 50000;      // Sliding window of the histogram and the voxel grid
+    int bins = 5;               // Temporal bins of the window, also the sliding step
+    int tau_us = 30000;         // Time surface decay
+    double publish_hz = 30;     // In event time
+    int threads = 4;            // Row tiles processed in parallel
+    uint32_t queue = 256;       // CD buffers queued for the engine
+};
+
+
+// Structure of arrays batch, each field is scanned on its own
+struct EventBatch {
+    std::vector<uint16_t> x;
+    std::vector<uint16_t> y;
+    std::vector<uint8_t> p;
+    std::vector<int64_t> t;
+
+    size_t size() const { return t.size(); }
+
+    // Any event type with x, y, p and t, Metavision::EventCD in practice
+    template <typename Event>
+    void assign(const Event *begin, const Event *end) {
+        size_t n = end - begin;
+        x.resize(n);
+        y.resize(n);
+        p.resize(n);
+        t.resize(n);
+        for(size_t i = 0; i < n; i++){
+            x[i] = begin[i].x;
+            y[i] = begin[i].y;
+            p[i] = begin[i].p > 0;
+            t[i] = begin[i].t;
+        }
+    }
+};
+
+
+// One published set of tensors. Empty Mats for disabled representations.
+struct Representations {
+    int64_t t_us = 0;               // Event time of the last event included
+    cv::Mat time_surface;           // CV_32FC2, exp(-(t_us - last event) / tau) for OFF and ON
+    cv::Mat histogram;              // CV_32SC2, OFF and ON counts over the window
+    cv::Mat voxel;                  // CV_16SC(bins), ON - OFF per bin, oldest bin first, the last one partial
+};
+
+
+
+// Keeps time surfaces, polarity histograms and voxel grids of one sensor up to date from its CD
+// events. The window is split into bins that each hold per-pixel counts. An event updates its
+// pixel's timestamp, its bin and the running histogram. When event time leaves a bin, the oldest
+// bin is subtracted from the histogram and reused. The sensor rows are split into tiles, one per
+// thread, and each tile only touches its own rows.
+//
+// Snapshots are published through a Mailbox at publish_hz while a consumer is attached. read()
+// hands out the consumer's buffer without copying.
+class RepresentationEngine {
+public:
+    RepresentationEngine(int width, int height, const Representation_config &config);
+
+    RepresentationEngine(const RepresentationEngine&) = delete;
+    RepresentationEngine& operator=(const RepresentationEngine&) = delete;
+
+    // From a single thread, events in time order
+    template <typename Event>
+    void process(const Event *begin, const Event *end) {
+        batch.assign(begin, end);
+        process(batch);
+    }
+    void process(const EventBatch &events);
+
+    // Consumers
+    void attach() { output.attach(); }
+    void detach() { output.detach(); }
+    bool read(Representations &out, uint64_t *seq = nullptr) { return output.read(out, seq); }
+
+    uint64_t events() const { return processed; }
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+private:
+    int w, h;
+    const Representation_config &config;
+    int64_t bin_us;
+    int tiles;
+    std::unique_ptr<ThreadPool> pool;
+
+    EventBatch batch;
+
+    std::vector<int64_t> last_ts;           // [polarity][pixel], 0 before the first event
+    std::vector<uint16_t> bin_counts;       // [bin][polarity][pixel], saturating
+    std::vector<uint32_t> window_counts;    // [polarity][pixel], sum of the bins
+    int current_bin;
+    int64_t bin_end;                        // Event time where the current bin ends
+    int64_t next_publish;
+    int64_t last_t;
+
+    std::atomic<uint64_t> processed;
+
+    Mailbox<Representations> output;
+
+    void tile_rows(int tile, int &y0, int &y1) const;
+    void accumulate(const EventBatch &events, size_t begin, size_t end);
+    void advance_bin();
+    void publish();
+};
@@ -0,0 +1,49 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+
+// Two-phase start of a recording session. Every device opens its outputs and calls
+// arrive_and_wait(), the controller waits for all of them with wait_armed() and releases them
+// together with commit(). abort() releases them with false, the devices then skip the session.
+class SessionBarrier {
+public:
+    void reset(size_t devices);
+
+    // Device threads, true when committed
+    bool arrive_and_wait();
+
+    // Controller
+    bool wait_armed(std::chrono::milliseconds timeout);
+    void commit();
+    void abort();
+
+    size_t armed();
+
+private:
+    enum class State { ARMING, COMMITTED, ABORTED };
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    State state = State::ABORTED;
+    size_t expected = 0;
+    size_t arrived = 0;
+};
@@ -0,0 +1,54 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#pragma once
+
+#include "device.hpp"
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+
+// Prepares the next session directory in the background: output_dir/.staged is created and every
+// device creates and preallocates its outputs in it. Starting a recording then only renames it
+// to the session name. stage() is called at start-up and whenever a session ends.
+class SessionStager {
+public:
+    SessionStager(const std::string &output_dir, std::vector<Device*> &devices);
+    ~SessionStager();
+
+    void stage();
+
+    // output_dir/name, from the staged directory when there is one. Waits for staging that is
+    // still running and creates the directory directly when staging failed.
+    fs::path take(const std::string &name);
+
+private:
+    fs::path output_dir;
+    fs::path staged_path;
+    std::vector<Device*> &devices;
+
+    std::mutex mutex;
+    std::thread worker;
+    bool staged = false;
+
+    void prepare();
+};
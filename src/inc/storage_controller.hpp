@@ -0,0 +1,104 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "device.hpp"
+
+namespace fs = boost::filesystem;
+
+
+enum class DegradeStep {
+    PREVIEW,        // Publish previews less often
+    DECIMATE,       // Ximea keeps only every Nth frame
+    ERC,            // Tighten the Prophesee event rate controller
+    STOP            // End the session cleanly
+};
+
+DegradeStep degrade_step_from_string(const std::string &name);
+const char* degrade_step_name(DegradeStep step);
+
+
+struct StorageController_config {
+    bool enabled = true;
+    int interval_ms = 1000;
+    double queue_high = 0.75;       // Queue fill that counts as falling behind
+    int sustain = 3;                // Samples under pressure before a step is taken
+    int hold_s = 10;                // Minimum time between two steps
+    double min_free_gb = 5;         // Below this the session is stopped right away, even without a stop step
+    double min_remaining_s = 300;   // Free space at the current write rate
+    std::vector<DegradeStep> steps = {DegradeStep::PREVIEW, DegradeStep::DECIMATE, DegradeStep::ERC, DegradeStep::STOP};
+
+    int preview_interval = 4;
+    int ximea_decimation = 2;
+    double erc_factor = 0.5;
+};
+
+
+// Watches queue depth, write rate and free space of the session volume while recording and
+// applies the configured degradation steps in order. Steps are kept until the session ends.
+// Samples and actions go to storage.log in the session directory.
+class StorageController {
+public:
+    typedef std::function<void()> StopFn;
+
+    StorageController(StorageController_config &config, std::vector<Device*> &devices, StopFn stop_session) :
+        config(config), devices(devices), stop_session(stop_session), stopped(false), active(false), stop_requested(false) {}
+
+    ~StorageController() {
+        stop();
+    }
+
+    void start();
+    void stop();
+
+    void start_session(const fs::path &path);
+    void end_session();
+
+private:
+    StorageController_config &config;
+    std::vector<Device*> &devices;
+    StopFn stop_session;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopped;
+    bool active;
+    bool stop_requested;
+
+    fs::path session_path;
+    std::ofstream log;
+    double session_start;
+    double last_step;
+    size_t next_step;
+    int pressure_samples;
+    std::vector<uint64_t> last_bytes;
+    double last_sample;
+
+    void run();
+    void sample();
+    bool apply(DegradeStep step, const std::string &reason);
+    void write_log(const std::string &line);
+};
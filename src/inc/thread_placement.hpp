@@ -0,0 +1,58 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <yaml-cpp/yaml.h>
+
+
+struct ThreadPlacement_config {
+    std::vector<int> cpus;          // Empty leaves the threads to the scheduler
+    int priority = 0;               // SCHED_FIFO priority 1-99, 0 keeps SCHED_OTHER
+    bool numa_local = true;         // Prefer the NUMA node of the first CPU for allocations
+
+    bool empty() const { return cpus.empty() && priority <= 0; }
+};
+
+void set_placement_config(ThreadPlacement_config &config, const YAML::Node &node);
+
+
+// Places the calling thread for as long as it lives and restores the previous placement
+// afterwards. Threads created meanwhile inherit the CPU set, the scheduling policy and the memory
+// policy, so a device thread started inside the scope takes its SDK, writer and pool threads and
+// the buffers they allocate along. What was applied and what the kernel refused is printed unless
+// report is false.
+class ScopedPlacement {
+public:
+    ScopedPlacement(const ThreadPlacement_config &config, const std::string &who, bool report = true);
+    ~ScopedPlacement();
+
+    ScopedPlacement(const ScopedPlacement&) = delete;
+    ScopedPlacement& operator=(const ScopedPlacement&) = delete;
+
+private:
+    bool affinity_set = false;
+    bool sched_set = false;
+    bool mempolicy_set = false;
+
+    cpu_set_t old_cpus;
+    int old_policy = SCHED_OTHER;
+    sched_param old_param;
+};
@@ -0,0 +1,63 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of worker threads for data parallel loops. parallel_for() may be called from several
+// threads at once, the caller works on its own loop too.
+class ThreadPool {
+public:
+    ThreadPool(int n_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Runs fn(0) ... fn(n - 1) and returns once all of them finished. The first exception thrown by
+    // fn is rethrown here, the remaining indices still run.
+    void parallel_for(size_t n, const std::function<void(size_t)> &fn);
+
+    size_t size() const { return threads.size(); }
+
+private:
+    struct Batch {
+        const std::function<void(size_t)> *fn;
+        size_t n;
+        std::atomic<size_t> next;
+        std::atomic<size_t> done;
+        size_t users;               // Workers inside run_batch(), guarded by mutex
+        std::atomic_bool failed;
+        std::exception_ptr error;   // Set once by the first index that threw
+    };
+
+    std::mutex mutex;
+    std::condition_variable work;
+    std::condition_variable finished;
+    std::deque<Batch*> batches;
+    std::vector<std::thread> threads;
+    bool stopped;
+
+    void run();
+    void run_batch(Batch &batch);
+};
@@ -23,19 +23,22 @@
 #include <opencv2/core.hpp> 
 
 #include "device.hpp"
+#include "thread_placement.hpp"
 
 
 
 class UI {
 
 public:
-    UI(std::vector<Device*>& cameras) : stopped(false), cameras(cameras){}
+    UI(std::vector<Device*>& cameras, const ThreadPlacement_config &placement = ThreadPlacement_config()) :
+        stopped(false), cameras(cameras), placement(placement){}
     
     ~UI() {
         stop();
     }
 
     void start() {
+        ScopedPlacement scoped(placement, "ui");
         thread = std::thread(&UI::run, this);
     }
 
@@ -57,6 +60,7 @@ private:
     std::atomic_bool stopped;
 ;
     std::vector<Device*>& cameras;
+    ThreadPlacement_config placement;
 
 
     void run();
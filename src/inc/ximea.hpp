@@ -15,7 +15,13 @@
 #pragma once
 
 #include "device.hpp"
+#include "frame_ring.hpp"
+#include "frame_sink.hpp"
+#include "ximea_telemetry.hpp"
+#include "clock_sync.hpp"
 #include <iostream>
+#include <memory>
+#include <sys/types.h>
 
 #include <boost/filesystem.hpp>
 
@@ -23,14 +29,14 @@ namespace fs = boost::filesystem;
 
 #include <opencv2/core.hpp> 
 #include <m3api/xiApi.h> // Linux, OSX
-
-void WriteImage(cv::Mat& image, char* filename);
+#include <yaml-cpp/yaml.h>
 
 
 
 
 struct Ximea_config{
-    std::string serial;
+    std::string serial;             // Empty opens the first camera
+    std::string output_name = "ximea";  // <name>/, <name>.pxf, <name>_ts.bin and <name>_telemetry.csv
     int aeag_level;
     int ae_max_lim;
     int fps;
@@ -38,6 +44,28 @@ struct Ximea_config{
     float ag_max_lim;
     bool ae_enabled;
 
+    // Recording pipeline
+    int writer_threads = 2;
+    int ring_slots = 32;
+    RingPolicy ring_policy = RingPolicy::DROP_NEWEST;
+    SinkType sink = SinkType::TIFF;
+    bool msb_align = true;      // Shift the 10 bit data to the top of the 16 bit words before saving
+    bool packed10 = false;      // Store 4 pixels in 5 bytes instead of one 16 bit word per pixel
+    CompressionConfig compression;
+
+    // Driver buffers, unsafe_buffers hands the driver's own buffers to the writers instead of copying each frame
+    bool unsafe_buffers = false;
+    int acq_buffer_size_mb = 0;     // 0 keeps the driver default
+    int buffers_queue_size = 0;
+
+    // Container output, see file_backend.hpp
+    IoBackend io_backend = IoBackend::BUFFERED;
+    int io_block_mb = 4;
+    int io_queue_depth = 8;
+    int expected_duration_s = 0;    // With fps sizes the preallocation of the container, 0 disables it
+
+    int telemetry_interval_ms = 1000;   // Skip counters and temperatures are polled off the capture loop
+    int preview_downscale = 1;      // Preview is width / (2 * preview_downscale) BGR8
 };
 
 
@@ -48,16 +76,50 @@ class Ximea : public Device {
 public:
     Ximea(Ximea_config &config):  Device(), config(config) {}
 
+    const char* name() const { return config.output_name.c_str(); }
+
+    StorageStatus storage_status();
+    bool decimate(int factor);
+    void reset_throttling();
+
+    // Frames are handed to the clock while recording, set before start()
+    void set_clock_sync(ClockSync *clock) { clock_sync = clock; }
+
 private:
     struct Ximea_config& config;
+    ClockSync *clock_sync = nullptr;
 
     fs::path timestamps_file;
     fs::path frames_path;
+    fs::path telemetry_file;
+
+    int width = 0;
+    int height = 0;
+    int buffers_queue_size = 0;
+    std::unique_ptr<FrameSink> sink;            // Owned by run() for the session
+    std::unique_ptr<FrameSink> pending_sink;    // Built by prepare_recording(), run() takes it over
+
+    // Container sink opened in the staged session directory, the open file survives the rename.
+    // prepare_recording() takes it when <name>.pxf of the session is still that file.
+    std::unique_ptr<FrameSink> staged_sink;
+    dev_t staged_dev = 0;
+    ino_t staged_ino = 0;
+
+    // Shared with the StorageController
+    std::atomic<int> save_decimation{1};
+    std::atomic<size_t> queue_depth{0};
+    std::atomic<size_t> queue_capacity{0};
+    std::atomic<uint64_t> session_bytes{0};
 
 	HANDLE xiH = NULL;
+    std::unique_ptr<XimeaTelemetry> telemetry;
+
     void init();
     void run();
     void prepare_recording(fs::path path);
+    void stage_recording(fs::path path);
+    uint64_t container_preallocation() const;
+    SinkFormat sink_format() const;
 
 };
 
@@ -76,3 +138,6 @@ private:
     void prepare_recording(fs::path path);
 
 };
+
+
+void set_ximea_config(Ximea_config &config, const YAML::Node &node);
@@ -0,0 +1,66 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#pragma once
+
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <m3api/xiApi.h> // Linux, OSX
+
+
+// Last values read by the sampler, NaN / -1 until the first sample
+struct XimeaHealth {
+    long long sample_us = 0;
+    int api_skipped = -1;           // Frames the API dropped because no buffer was free
+    int transport_skipped = -1;     // Frames lost between the camera and the host
+    float sensor_temp = NAN;
+    float board_temp = NAN;
+};
+
+
+// Polls slow camera counters and temperatures on its own thread, so the capture loop never
+// has to wait on a driver round trip for them. Samples are appended to a CSV in the session.
+class XimeaTelemetry {
+public:
+    XimeaTelemetry(HANDLE &xiH, int interval_ms) : xiH(xiH), interval_ms(interval_ms), running(false) {}
+
+    ~XimeaTelemetry() {
+        stop();
+    }
+
+    void start(const std::string &csv_path);
+    void stop();
+
+    XimeaHealth latest();
+
+private:
+    HANDLE &xiH;
+    int interval_ms;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running;
+
+    XimeaHealth health;
+    std::ofstream csv;
+
+    void run();
+    void sample();
+};
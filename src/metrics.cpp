@@ -0,0 +1,311 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "metrics.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+const std::vector<double> LATENCY_BUCKETS = {0.0005, 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1};
+
+
+Histogram::Histogram(const std::vector<double> &bounds) : upper_bounds(bounds),
+    counts(new std::atomic<uint64_t>[bounds.size() + 1])
+{
+    for(size_t i = 0; i <= bounds.size(); i++){
+        counts[i] = 0;
+    }
+}
+
+void Histogram::observe(double v){
+    size_t i = 0;
+    while(i < upper_bounds.size() && v > upper_bounds[i]){
+        i++;
+    }
+    counts[i].fetch_add(1, std::memory_order_relaxed);
+
+    double old = total.load(std::memory_order_relaxed);
+    while(!total.compare_exchange_weak(old, old + v, std::memory_order_relaxed)){
+    }
+}
+
+uint64_t Histogram::count() const {
+    uint64_t n = 0;
+    for(size_t i = 0; i <= upper_bounds.size(); i++){
+        n += bucket(i);
+    }
+    return n;
+}
+
+
+
+MetricsRegistry::Series& MetricsRegistry::series(const std::string &name, const std::string &help, Type type,
+                                                 const std::string &labels){
+    auto it = by_name.find(name);
+    Family *family;
+    if(it == by_name.end()){
+        families.push_back(Family{name, help, type, {}});
+        family = &families.back();
+        by_name[name] = family;
+    } else {
+        family = it->second;
+        if(family->type != type){
+            std::cerr << "Metric " << name << " registered with two types" << std::endl;
+            throw "Metric type mismatch";
+        }
+    }
+
+    for(Series &s : family->series){
+        if(s.labels == labels){
+            return s;
+        }
+    }
+    family->series.emplace_back();
+    family->series.back().labels = labels;
+    return family->series.back();
+}
+
+
+Counter& MetricsRegistry::counter(const std::string &name, const std::string &help, const std::string &labels){
+    std::lock_guard<std::mutex> lock(mutex);
+    Series &s = series(name, help, Type::COUNTER, labels);
+    if(!s.counter){
+        s.counter.reset(new Counter());
+    }
+    return *s.counter;
+}
+
+Gauge& MetricsRegistry::gauge(const std::string &name, const std::string &help, const std::string &labels){
+    std::lock_guard<std::mutex> lock(mutex);
+    Series &s = series(name, help, Type::GAUGE, labels);
+    if(!s.gauge){
+        s.gauge.reset(new Gauge());
+    }
+    return *s.gauge;
+}
+
+Histogram& MetricsRegistry::histogram(const std::string &name, const std::string &help, const std::string &labels,
+                                      const std::vector<double> &bounds){
+    std::lock_guard<std::mutex> lock(mutex);
+    Series &s = series(name, help, Type::HISTOGRAM, labels);
+    if(!s.histogram){
+        s.histogram.reset(new Histogram(bounds));
+    }
+    return *s.histogram;
+}
+
+
+void MetricsRegistry::add_collector(std::function<void()> collector){
+    std::lock_guard<std::mutex> lock(mutex);
+    collectors.push_back(collector);
+}
+
+
+static std::string format_value(double v){
+    if(std::isinf(v)){
+        return v > 0 ? "+Inf" : "-Inf";
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.15g", v);
+    return buffer;
+}
+
+// name{labels} or name{labels,extra}
+static std::string series_name(const std::string &name, const std::string &labels, const std::string &extra = ""){
+    std::string all = labels;
+    if(!extra.empty()){
+        all += (all.empty() ? "" : ",") + extra;
+    }
+    return all.empty() ? name : name + "{" + all + "}";
+}
+
+
+std::string MetricsRegistry::render(){
+    std::vector<std::function<void()>> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = collectors;
+    }
+    // Collectors register and set metrics themselves, so they run without the mutex
+    for(auto &collector : pending){
+        collector();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string out;
+    for(const Family &f : families){
+        static const char *type_names[] = {"counter", "gauge", "histogram"};
+        out += "# HELP " + f.name + " " + f.help + "\n";
+        out += "# TYPE " + f.name + " " + type_names[(int)f.type] + "\n";
+
+        for(const Series &s : f.series){
+            if(s.counter){
+                out += series_name(f.name, s.labels) + " " + std::to_string(s.counter->get()) + "\n";
+            } else if(s.gauge){
+                out += series_name(f.name, s.labels) + " " + format_value(s.gauge->get()) + "\n";
+            } else if(s.histogram){
+                const Histogram &h = *s.histogram;
+                uint64_t cumulative = 0;
+                for(size_t i = 0; i <= h.bounds().size(); i++){
+                    cumulative += h.bucket(i);
+                    std::string le = i < h.bounds().size() ? format_value(h.bounds()[i]) : "+Inf";
+                    out += series_name(f.name + "_bucket", s.labels, "le=\"" + le + "\"") + " " + std::to_string(cumulative) + "\n";
+                }
+                out += series_name(f.name + "_sum", s.labels) + " " + format_value(h.sum()) + "\n";
+                out += series_name(f.name + "_count", s.labels) + " " + std::to_string(cumulative) + "\n";
+            }
+        }
+    }
+    return out;
+}
+
+
+
+
+MetricsServer::MetricsServer(MetricsRegistry &registry, const Metrics_config &config) : registry(registry), config(config) {}
+
+MetricsServer::~MetricsServer(){
+    stop();
+}
+
+
+void MetricsServer::start(){
+    if(config.port > 0){
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(config.port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0){
+            std::cerr << "Metrics: cannot listen on 127.0.0.1:" << config.port << ": " << strerror(errno) << std::endl;
+            if(fd >= 0){
+                close(fd);
+            }
+        } else {
+            listeners.push_back(fd);
+            printf("Metrics on http://127.0.0.1:%d/metrics\n", config.port);
+        }
+    }
+
+    if(!config.unix_socket.empty()){
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, config.unix_socket.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(config.unix_socket.c_str());
+        if(fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0){
+            std::cerr << "Metrics: cannot listen on " << config.unix_socket << ": " << strerror(errno) << std::endl;
+            if(fd >= 0){
+                close(fd);
+            }
+        } else {
+            listeners.push_back(fd);
+            printf("Metrics on unix:%s\n", config.unix_socket.c_str());
+        }
+    }
+
+    if(!listeners.empty()){
+        thread = std::thread(&MetricsServer::run, this);
+    }
+}
+
+
+void MetricsServer::stop(){
+    stopped = true;
+    if(thread.joinable()){
+        thread.join();
+    }
+    if(listeners.empty()){
+        return;
+    }
+    for(int fd : listeners){
+        close(fd);
+    }
+    listeners.clear();
+    if(!config.unix_socket.empty()){
+        unlink(config.unix_socket.c_str());
+    }
+}
+
+
+void MetricsServer::run(){
+    std::vector<pollfd> fds;
+    for(int fd : listeners){
+        fds.push_back(pollfd{fd, POLLIN, 0});
+    }
+
+    while(!stopped){
+        if(poll(fds.data(), fds.size(), 200) <= 0){
+            continue;
+        }
+        for(pollfd &p : fds){
+            if(p.revents & POLLIN){
+                int client = accept(p.fd, nullptr, nullptr);
+                if(client >= 0){
+                    serve(client);
+                    close(client);
+                }
+            }
+        }
+    }
+}
+
+
+// One response per connection, whatever was asked for
+void MetricsServer::serve(int fd){
+    timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Read the request head, the body of a GET is empty
+    std::string request;
+    char buffer[1024];
+    while(request.find("\r\n\r\n") == std::string::npos && request.size() < 8192){
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if(n <= 0){
+            break;
+        }
+        request.append(buffer, n);
+    }
+
+    std::string body = registry.render();
+    std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+
+    size_t sent = 0;
+    while(sent < response.size()){
+        ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0){
+            break;
+        }
+        sent += n;
+    }
+}
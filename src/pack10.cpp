@@ -0,0 +1,316 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#include "pack10.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PACK10_X86
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PACK10_NEON
+#endif
+
+
+
+static void pack10_scalar(const uint16_t *src, uint8_t *dst, size_t n, int bit_shift){
+    size_t i = 0;
+
+    for(; i + 4 <= n; i += 4, dst += 5){
+        uint64_t v = (uint64_t)((src[i]     >> bit_shift) & 0x3ff) << 30
+                   | (uint64_t)((src[i + 1] >> bit_shift) & 0x3ff) << 20
+                   | (uint64_t)((src[i + 2] >> bit_shift) & 0x3ff) << 10
+                   | (uint64_t)((src[i + 3] >> bit_shift) & 0x3ff);
+        dst[0] = v >> 32;
+        dst[1] = v >> 24;
+        dst[2] = v >> 16;
+        dst[3] = v >> 8;
+        dst[4] = v;
+    }
+
+    // Row tail, the last byte is zero padded
+    if(i < n){
+        uint64_t v = 0;
+        size_t rest = n - i;
+        for(size_t k = 0; k < rest; k++){
+            v = (v << 10) | ((src[i + k] >> bit_shift) & 0x3ff);
+        }
+        size_t bits = rest * 10;
+        size_t bytes = (bits + 7) / 8;
+        v <<= bytes * 8 - bits;
+        for(size_t k = 0; k < bytes; k++){
+            dst[k] = v >> (8 * (bytes - 1 - k));
+        }
+    }
+}
+
+
+static void unpack10_scalar(const uint8_t *src, uint16_t *dst, size_t n, int bit_shift){
+    size_t i = 0;
+
+    for(; i + 4 <= n; i += 4, src += 5){
+        uint64_t v = (uint64_t)src[0] << 32 | (uint64_t)src[1] << 24 | (uint64_t)src[2] << 16
+                   | (uint64_t)src[3] << 8 | src[4];
+        dst[i]     = ((v >> 30) & 0x3ff) << bit_shift;
+        dst[i + 1] = ((v >> 20) & 0x3ff) << bit_shift;
+        dst[i + 2] = ((v >> 10) & 0x3ff) << bit_shift;
+        dst[i + 3] = (v & 0x3ff) << bit_shift;
+    }
+
+    if(i < n){
+        size_t rest = n - i;
+        size_t bits = rest * 10;
+        size_t bytes = (bits + 7) / 8;
+        uint64_t v = 0;
+        for(size_t k = 0; k < bytes; k++){
+            v = (v << 8) | src[k];
+        }
+        v >>= bytes * 8 - bits;
+        for(size_t k = 0; k < rest; k++){
+            dst[i + k] = ((v >> (10 * (rest - 1 - k))) & 0x3ff) << bit_shift;
+        }
+    }
+}
+
+
+
+#ifdef PACK10_X86
+
+/*
+ * Each 64 bit lane holds 4 pixels a | b << 16 | c << 32 | d << 48. They are merged into the 40 bit
+ * big endian group a << 30 | b << 20 | c << 10 | d, whose 5 low bytes are then reversed by pshufb.
+ */
+
+__attribute__((target("ssse3")))
+static inline __m128i pack10_lanes_sse(__m128i v, __m128i shift){
+    const __m128i mask10 = _mm_set1_epi16(0x3ff);
+    const __m128i mask_a = _mm_set1_epi64x(0x3ffULL);
+    const __m128i mask_b = _mm_set1_epi64x(0x3ffULL << 16);
+    const __m128i mask_c = _mm_set1_epi64x(0x3ffULL << 32);
+
+    v = _mm_and_si128(_mm_srl_epi16(v, shift), mask10);
+
+    __m128i g = _mm_slli_epi64(_mm_and_si128(v, mask_a), 30);
+    g = _mm_or_si128(g, _mm_slli_epi64(_mm_and_si128(v, mask_b), 4));
+    g = _mm_or_si128(g, _mm_srli_epi64(_mm_and_si128(v, mask_c), 22));
+    g = _mm_or_si128(g, _mm_srli_epi64(v, 48));
+
+    const __m128i order = _mm_setr_epi8(4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1);
+    return _mm_shuffle_epi8(g, order);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i unpack10_lanes_sse(__m128i bytes, __m128i shift){
+    const __m128i order = _mm_setr_epi8(4, 3, 2, 1, 0, -1, -1, -1, 9, 8, 7, 6, 5, -1, -1, -1);
+    __m128i g = _mm_shuffle_epi8(bytes, order);
+
+    __m128i v = _mm_and_si128(_mm_srli_epi64(g, 30), _mm_set1_epi64x(0x3ffULL));
+    v = _mm_or_si128(v, _mm_and_si128(_mm_srli_epi64(g, 4), _mm_set1_epi64x(0x3ffULL << 16)));
+    v = _mm_or_si128(v, _mm_and_si128(_mm_slli_epi64(g, 22), _mm_set1_epi64x(0x3ffULL << 32)));
+    v = _mm_or_si128(v, _mm_and_si128(_mm_slli_epi64(g, 48), _mm_set1_epi64x(0x3ffULL << 48)));
+
+    return _mm_sll_epi16(v, shift);
+}
+
+
+__attribute__((target("ssse3")))
+static void pack10_ssse3(const uint16_t *src, uint8_t *dst, size_t n, int bit_shift){
+    const __m128i shift = _mm_cvtsi32_si128(bit_shift);
+    size_t i = 0;
+
+    for(; i + 8 <= n; i += 8, dst += 10){
+        __m128i p = pack10_lanes_sse(_mm_loadu_si128((const __m128i*)(src + i)), shift);
+        _mm_storel_epi64((__m128i*)dst, p);
+        uint16_t tail = _mm_extract_epi16(p, 4);
+        memcpy(dst + 8, &tail, 2);
+    }
+    pack10_scalar(src + i, dst, n - i, bit_shift);
+}
+
+__attribute__((target("ssse3")))
+static void unpack10_ssse3(const uint8_t *src, uint16_t *dst, size_t n, int bit_shift){
+    const __m128i shift = _mm_cvtsi32_si128(bit_shift);
+    size_t i = 0;
+
+    // 16 byte loads for 10 bytes of input, keep the over-read inside the row
+    for(; i + 8 <= n && (n - i) * 10 / 8 >= 16; i += 8, src += 10){
+        __m128i v = unpack10_lanes_sse(_mm_loadu_si128((const __m128i*)src), shift);
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+    }
+    unpack10_scalar(src, dst + i, n - i, bit_shift);
+}
+
+
+__attribute__((target("avx2")))
+static void pack10_avx2(const uint16_t *src, uint8_t *dst, size_t n, int bit_shift){
+    const __m128i shift = _mm_cvtsi32_si128(bit_shift);
+    const __m256i mask10 = _mm256_set1_epi16(0x3ff);
+    const __m256i mask_a = _mm256_set1_epi64x(0x3ffULL);
+    const __m256i mask_b = _mm256_set1_epi64x(0x3ffULL << 16);
+    const __m256i mask_c = _mm256_set1_epi64x(0x3ffULL << 32);
+    const __m256i order = _mm256_setr_epi8(4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1,
+                                           4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1);
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16, dst += 20){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        v = _mm256_and_si256(_mm256_srl_epi16(v, shift), mask10);
+
+        __m256i g = _mm256_slli_epi64(_mm256_and_si256(v, mask_a), 30);
+        g = _mm256_or_si256(g, _mm256_slli_epi64(_mm256_and_si256(v, mask_b), 4));
+        g = _mm256_or_si256(g, _mm256_srli_epi64(_mm256_and_si256(v, mask_c), 22));
+        g = _mm256_or_si256(g, _mm256_srli_epi64(v, 48));
+        g = _mm256_shuffle_epi8(g, order);
+
+        // 10 packed bytes at the bottom of each 128 bit half
+        __m128i lo = _mm256_castsi256_si128(g);
+        __m128i hi = _mm256_extracti128_si256(g, 1);
+        _mm_storel_epi64((__m128i*)dst, lo);
+        uint16_t tail = _mm_extract_epi16(lo, 4);
+        memcpy(dst + 8, &tail, 2);
+        _mm_storel_epi64((__m128i*)(dst + 10), hi);
+        tail = _mm_extract_epi16(hi, 4);
+        memcpy(dst + 18, &tail, 2);
+    }
+    pack10_ssse3(src + i, dst, n - i, bit_shift);
+}
+
+__attribute__((target("avx2")))
+static void unpack10_avx2(const uint8_t *src, uint16_t *dst, size_t n, int bit_shift){
+    const __m128i shift = _mm_cvtsi32_si128(bit_shift);
+    const __m256i order = _mm256_setr_epi8(4, 3, 2, 1, 0, -1, -1, -1, 9, 8, 7, 6, 5, -1, -1, -1,
+                                           4, 3, 2, 1, 0, -1, -1, -1, 9, 8, 7, 6, 5, -1, -1, -1);
+    size_t i = 0;
+
+    // Second half is loaded from src + 10, 26 readable bytes are needed
+    for(; i + 16 <= n && (n - i) * 10 / 8 >= 26; i += 16, src += 20){
+        __m256i bytes = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)src)),
+            _mm_loadu_si128((const __m128i*)(src + 10)), 1);
+        __m256i g = _mm256_shuffle_epi8(bytes, order);
+
+        __m256i v = _mm256_and_si256(_mm256_srli_epi64(g, 30), _mm256_set1_epi64x(0x3ffULL));
+        v = _mm256_or_si256(v, _mm256_and_si256(_mm256_srli_epi64(g, 4), _mm256_set1_epi64x(0x3ffULL << 16)));
+        v = _mm256_or_si256(v, _mm256_and_si256(_mm256_slli_epi64(g, 22), _mm256_set1_epi64x(0x3ffULL << 32)));
+        v = _mm256_or_si256(v, _mm256_and_si256(_mm256_slli_epi64(g, 48), _mm256_set1_epi64x(0x3ffULL << 48)));
+
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_sll_epi16(v, shift));
+    }
+    unpack10_ssse3(src, dst + i, n - i, bit_shift);
+}
+
+#endif
+
+
+
+#ifdef PACK10_NEON
+
+static void pack10_neon(const uint16_t *src, uint8_t *dst, size_t n, int bit_shift){
+    const int16x8_t shift = vdupq_n_s16(-bit_shift);
+    const uint16x8_t mask10 = vdupq_n_u16(0x3ff);
+    const uint64x2_t mask_a = vdupq_n_u64(0x3ffULL);
+    const uint64x2_t mask_b = vdupq_n_u64(0x3ffULL << 16);
+    const uint64x2_t mask_c = vdupq_n_u64(0x3ffULL << 32);
+    const uint8_t order_bytes[16] = {4, 3, 2, 1, 0, 12, 11, 10, 9, 8, 255, 255, 255, 255, 255, 255};
+    const uint8x16_t order = vld1q_u8(order_bytes);
+    size_t i = 0;
+
+    for(; i + 8 <= n; i += 8, dst += 10){
+        uint16x8_t p = vandq_u16(vshlq_u16(vld1q_u16(src + i), shift), mask10);
+        uint64x2_t v = vreinterpretq_u64_u16(p);
+
+        uint64x2_t g = vshlq_n_u64(vandq_u64(v, mask_a), 30);
+        g = vorrq_u64(g, vshlq_n_u64(vandq_u64(v, mask_b), 4));
+        g = vorrq_u64(g, vshrq_n_u64(vandq_u64(v, mask_c), 22));
+        g = vorrq_u64(g, vshrq_n_u64(v, 48));
+
+        uint8x16_t out = vqtbl1q_u8(vreinterpretq_u8_u64(g), order);
+        vst1_u8(dst, vget_low_u8(out));
+        dst[8] = vgetq_lane_u8(out, 8);
+        dst[9] = vgetq_lane_u8(out, 9);
+    }
+    pack10_scalar(src + i, dst, n - i, bit_shift);
+}
+
+static void unpack10_neon(const uint8_t *src, uint16_t *dst, size_t n, int bit_shift){
+    const int16x8_t shift = vdupq_n_s16(bit_shift);
+    const uint8_t order_bytes[16] = {4, 3, 2, 1, 0, 255, 255, 255, 9, 8, 7, 6, 5, 255, 255, 255};
+    const uint8x16_t order = vld1q_u8(order_bytes);
+    size_t i = 0;
+
+    for(; i + 8 <= n && (n - i) * 10 / 8 >= 16; i += 8, src += 10){
+        uint64x2_t g = vreinterpretq_u64_u8(vqtbl1q_u8(vld1q_u8(src), order));
+
+        uint64x2_t v = vandq_u64(vshrq_n_u64(g, 30), vdupq_n_u64(0x3ffULL));
+        v = vorrq_u64(v, vandq_u64(vshrq_n_u64(g, 4), vdupq_n_u64(0x3ffULL << 16)));
+        v = vorrq_u64(v, vandq_u64(vshlq_n_u64(g, 22), vdupq_n_u64(0x3ffULL << 32)));
+        v = vorrq_u64(v, vandq_u64(vshlq_n_u64(g, 48), vdupq_n_u64(0x3ffULL << 48)));
+
+        vst1q_u16(dst + i, vshlq_u16(vreinterpretq_u16_u64(v), shift));
+    }
+    unpack10_scalar(src, dst + i, n - i, bit_shift);
+}
+
+#endif
+
+
+
+std::vector<Pack10Kernel> available_pack10_kernels(){
+    std::vector<Pack10Kernel> kernels;
+    kernels.push_back({"scalar", pack10_scalar, unpack10_scalar});
+
+#ifdef PACK10_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3")){
+        kernels.push_back({"ssse3", pack10_ssse3, unpack10_ssse3});
+    }
+    if(__builtin_cpu_supports("avx2")){
+        kernels.push_back({"avx2", pack10_avx2, unpack10_avx2});
+    }
+#endif
+
+#ifdef PACK10_NEON
+    kernels.push_back({"neon", pack10_neon, unpack10_neon});
+#endif
+
+    return kernels;
+}
+
+
+const Pack10Kernel& best_pack10_kernel(){
+    static const Pack10Kernel best = available_pack10_kernels().back();
+    return best;
+}
+
+
+
+void pack10_image(const uint16_t *src, size_t src_step, uint8_t *dst, int width, int height, int bit_shift){
+    const Pack10Kernel &kernel = best_pack10_kernel();
+    size_t row_bytes = packed10_row_bytes(width);
+
+    for(int y = 0; y < height; y++){
+        kernel.pack((const uint16_t*)((const uint8_t*)src + y * src_step), dst + y * row_bytes, width, bit_shift);
+    }
+}
+
+void unpack10_image(const uint8_t *src, uint16_t *dst, size_t dst_step, int width, int height, int bit_shift){
+    const Pack10Kernel &kernel = best_pack10_kernel();
+    size_t row_bytes = packed10_row_bytes(width);
+
+    for(int y = 0; y < height; y++){
+        kernel.unpack(src + y * row_bytes, (uint16_t*)((uint8_t*)dst + y * dst_step), width, bit_shift);
+    }
+}
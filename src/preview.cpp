@@ -0,0 +1,275 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "preview.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PREVIEW_X86
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PREVIEW_NEON
+#endif
+
+
+
+static inline uint8_t to_u8(uint32_t v, int shift){
+    v = (v + (1u << (shift - 1))) >> shift;
+    return v > 255 ? 255 : v;
+}
+
+static void preview_row_scalar(const uint16_t *gb, const uint16_t *rg, uint8_t *bgr, size_t n, int shift){
+    for(size_t i = 0; i < n; i++, gb += 2, rg += 2, bgr += 3){
+        bgr[0] = to_u8(gb[1], shift);
+        bgr[1] = to_u8((gb[0] + rg[1] + 1) >> 1, shift);
+        bgr[2] = to_u8(rg[0], shift);
+    }
+}
+
+
+
+#ifdef PREVIEW_X86
+
+/*
+ * Each 32 bit lane holds one cell of a row: G | B << 16 for the first row, R | G << 16 for the second.
+ * Channels are separated with and / shift, scaled in 32 bit, narrowed to bytes and finally
+ * interleaved to BGR by pshufb.
+ */
+
+// pshufb masks that pick channel c of 16 cells into output block b (48 bytes = 3 blocks)
+struct InterleaveMasks {
+    __m128i m[3][3];
+};
+
+__attribute__((target("ssse3")))
+static InterleaveMasks interleave_masks(){
+    InterleaveMasks masks;
+    for(int block = 0; block < 3; block++){
+        for(int c = 0; c < 3; c++){
+            alignas(16) int8_t m[16];
+            for(int t = 0; t < 16; t++){
+                int j = block * 16 + t;
+                m[t] = j % 3 == c ? j / 3 : -1;
+            }
+            masks.m[block][c] = _mm_load_si128((const __m128i*)m);
+        }
+    }
+    return masks;
+}
+
+__attribute__((target("ssse3")))
+static inline void store_bgr16(uint8_t *dst, __m128i b, __m128i g, __m128i r, const InterleaveMasks &masks){
+    for(int block = 0; block < 3; block++){
+        __m128i v = _mm_or_si128(_mm_shuffle_epi8(b, masks.m[block][0]),
+                    _mm_or_si128(_mm_shuffle_epi8(g, masks.m[block][1]), _mm_shuffle_epi8(r, masks.m[block][2])));
+        _mm_storeu_si128((__m128i*)(dst + 16 * block), v);
+    }
+}
+
+// 4 cells, channels as 32 bit lanes
+__attribute__((target("ssse3")))
+static inline void cells_sse(const uint16_t *gb, const uint16_t *rg, __m128i round, __m128i shift,
+                             __m128i &b, __m128i &g, __m128i &r){
+    const __m128i low = _mm_set1_epi32(0xffff);
+    __m128i top = _mm_loadu_si128((const __m128i*)gb);
+    __m128i bottom = _mm_loadu_si128((const __m128i*)rg);
+
+    __m128i g_avg = _mm_avg_epu16(_mm_and_si128(top, low), _mm_srli_epi32(bottom, 16));
+    b = _mm_srl_epi32(_mm_add_epi32(_mm_srli_epi32(top, 16), round), shift);
+    g = _mm_srl_epi32(_mm_add_epi32(g_avg, round), shift);
+    r = _mm_srl_epi32(_mm_add_epi32(_mm_and_si128(bottom, low), round), shift);
+}
+
+__attribute__((target("ssse3")))
+static void preview_row_ssse3(const uint16_t *gb, const uint16_t *rg, uint8_t *bgr, size_t n, int shift){
+    const InterleaveMasks masks = interleave_masks();
+    const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for(; i + 16 <= n; i += 16){
+        __m128i b[4], g[4], r[4];
+        for(int k = 0; k < 4; k++){
+            cells_sse(gb + 2 * (i + 4 * k), rg + 2 * (i + 4 * k), round, count, b[k], g[k], r[k]);
+        }
+        // Values fit in 15 bits for shift >= 1, the signed pack is safe
+        __m128i b8 = _mm_packus_epi16(_mm_packs_epi32(b[0], b[1]), _mm_packs_epi32(b[2], b[3]));
+        __m128i g8 = _mm_packus_epi16(_mm_packs_epi32(g[0], g[1]), _mm_packs_epi32(g[2], g[3]));
+        __m128i r8 = _mm_packus_epi16(_mm_packs_epi32(r[0], r[1]), _mm_packs_epi32(r[2], r[3]));
+        store_bgr16(bgr + 3 * i, b8, g8, r8, masks);
+    }
+    preview_row_scalar(gb + 2 * i, rg + 2 * i, bgr + 3 * i, n - i, shift);
+}
+
+
+// 8 cells, channels as 32 bit lanes
+__attribute__((target("avx2")))
+static inline void cells_avx2(const uint16_t *gb, const uint16_t *rg, __m256i round, __m128i shift,
+                              __m256i &b, __m256i &g, __m256i &r){
+    const __m256i low = _mm256_set1_epi32(0xffff);
+    __m256i top = _mm256_loadu_si256((const __m256i*)gb);
+    __m256i bottom = _mm256_loadu_si256((const __m256i*)rg);
+
+    __m256i g_avg = _mm256_avg_epu16(_mm256_and_si256(top, low), _mm256_srli_epi32(bottom, 16));
+    b = _mm256_srl_epi32(_mm256_add_epi32(_mm256_srli_epi32(top, 16), round), shift);
+    g = _mm256_srl_epi32(_mm256_add_epi32(g_avg, round), shift);
+    r = _mm256_srl_epi32(_mm256_add_epi32(_mm256_and_si256(bottom, low), round), shift);
+}
+
+// 32 cells of one channel to bytes in cell order. The packs work per 128 bit lane, the permute restores the order.
+__attribute__((target("avx2")))
+static inline __m256i narrow_avx2(const __m256i v[4]){
+    __m256i w = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+    return _mm256_permutevar8x32_epi32(w, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+__attribute__((target("avx2")))
+static void preview_row_avx2(const uint16_t *gb, const uint16_t *rg, uint8_t *bgr, size_t n, int shift){
+    const InterleaveMasks masks = interleave_masks();
+    const __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    for(; i + 32 <= n; i += 32){
+        __m256i b[4], g[4], r[4];
+        for(int k = 0; k < 4; k++){
+            cells_avx2(gb + 2 * (i + 8 * k), rg + 2 * (i + 8 * k), round, count, b[k], g[k], r[k]);
+        }
+        __m256i b8 = narrow_avx2(b), g8 = narrow_avx2(g), r8 = narrow_avx2(r);
+
+        store_bgr16(bgr + 3 * i, _mm256_castsi256_si128(b8), _mm256_castsi256_si128(g8), _mm256_castsi256_si128(r8), masks);
+        store_bgr16(bgr + 3 * (i + 16), _mm256_extracti128_si256(b8, 1), _mm256_extracti128_si256(g8, 1),
+                    _mm256_extracti128_si256(r8, 1), masks);
+    }
+    preview_row_ssse3(gb + 2 * i, rg + 2 * i, bgr + 3 * i, n - i, shift);
+}
+
+#endif
+
+
+
+#ifdef PREVIEW_NEON
+
+static void preview_row_neon(const uint16_t *gb, const uint16_t *rg, uint8_t *bgr, size_t n, int shift){
+    const int16x8_t count = vdupq_n_s16(-shift);
+    size_t i = 0;
+
+    for(; i + 8 <= n; i += 8){
+        uint16x8x2_t top = vld2q_u16(gb + 2 * i);       // G, B
+        uint16x8x2_t bottom = vld2q_u16(rg + 2 * i);    // R, G
+
+        uint8x8x3_t out;
+        out.val[0] = vqmovn_u16(vrshlq_u16(top.val[1], count));
+        out.val[1] = vqmovn_u16(vrshlq_u16(vrhaddq_u16(top.val[0], bottom.val[1]), count));
+        out.val[2] = vqmovn_u16(vrshlq_u16(bottom.val[0], count));
+        vst3_u8(bgr + 3 * i, out);
+    }
+    preview_row_scalar(gb + 2 * i, rg + 2 * i, bgr + 3 * i, n - i, shift);
+}
+
+#endif
+
+
+
+std::vector<PreviewKernel> available_preview_kernels(){
+    std::vector<PreviewKernel> kernels;
+    kernels.push_back({"scalar", preview_row_scalar});
+
+#ifdef PREVIEW_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3")){
+        kernels.push_back({"ssse3", preview_row_ssse3});
+    }
+    if(__builtin_cpu_supports("avx2")){
+        kernels.push_back({"avx2", preview_row_avx2});
+    }
+#endif
+
+#ifdef PREVIEW_NEON
+    kernels.push_back({"neon", preview_row_neon});
+#endif
+
+    return kernels;
+}
+
+const PreviewKernel& best_preview_kernel(){
+    static const PreviewKernel kernel = available_preview_kernels().back();
+    return kernel;
+}
+
+
+
+// Box filters downscale x downscale cells of one colour phase (every other row starting at first)
+// into a mosaic row of width / downscale samples
+static void reduce_cells(const uint8_t *first, size_t src_step, size_t cells, int downscale,
+                         std::vector<uint32_t> &acc, uint16_t *dst){
+    size_t width = 2 * cells * downscale;
+    acc.assign(width, 0);
+
+    // Row sums, plain loops that the compiler vectorizes
+    for(int k = 0; k < downscale; k++){
+        const uint16_t *row = (const uint16_t*)(first + 2 * k * src_step);
+        for(size_t x = 0; x < width; x++){
+            acc[x] += row[x];
+        }
+    }
+
+    uint32_t area = downscale * downscale;
+    for(size_t i = 0; i < cells; i++){
+        uint32_t sum[2] = {0, 0};
+        const uint32_t *cell = acc.data() + 2 * i * downscale;
+        for(int k = 0; k < downscale; k++){
+            sum[0] += cell[2 * k];
+            sum[1] += cell[2 * k + 1];
+        }
+        dst[2 * i]     = (sum[0] + area / 2) / area;
+        dst[2 * i + 1] = (sum[1] + area / 2) / area;
+    }
+}
+
+
+void preview_gbrg(const uint16_t *src, size_t src_step, int width, int height,
+                  uint8_t *dst, size_t dst_step, int downscale, int shift, const PreviewKernel &kernel){
+    if(downscale < 1 || shift < 1 || shift > 8){
+        throw "Invalid preview parameters";
+    }
+
+    int out_w = preview_size(width, downscale);
+    int out_h = preview_size(height, downscale);
+    const uint8_t *base = (const uint8_t*)src;
+
+    if(downscale == 1){
+        for(int y = 0; y < out_h; y++){
+            const uint16_t *gb = (const uint16_t*)(base + 2 * y * src_step);
+            const uint16_t *rg = (const uint16_t*)(base + (2 * y + 1) * src_step);
+            kernel.row(gb, rg, dst + y * dst_step, out_w, shift);
+        }
+        return;
+    }
+
+    // Reduced rows stay in cache, allocated once per thread
+    thread_local std::vector<uint32_t> acc;
+    thread_local std::vector<uint16_t> rows;
+    rows.resize(4 * (size_t)out_w);
+    uint16_t *gb = rows.data();
+    uint16_t *rg = rows.data() + 2 * out_w;
+
+    for(int y = 0; y < out_h; y++){
+        const uint8_t *block = base + 2 * (size_t)y * downscale * src_step;
+        reduce_cells(block, src_step, out_w, downscale, acc, gb);
+        reduce_cells(block + src_step, src_step, out_w, downscale, acc, rg);
+        kernel.row(gb, rg, dst + y * dst_step, out_w, shift);
+    }
+}
@@ -25,6 +25,7 @@
 #include <atomic>
 #include <chrono>
 #include <iomanip>
+#include <memory>
 #include <thread> 
 
 
@@ -73,6 +74,73 @@ void set_prophesee_config(Prophesee_config &config, const YAML::Node &node){
         config.erc_rate = node["erc_rate"].as<uint32_t>();
     }
 
+    if(node["erc_control"]){
+        const YAML::Node &erc = node["erc_control"];
+        ErcControl_config &c = config.erc_control;
+        if(erc["enabled"])          c.enabled = erc["enabled"].as<bool>();
+        if(erc["min_mev"])          c.min_mev = erc["min_mev"].as<double>();
+        if(erc["max_mev"])          c.max_mev = erc["max_mev"].as<double>();
+        if(erc["high"])             c.high = erc["high"].as<double>();
+        if(erc["low"])              c.low = erc["low"].as<double>();
+        if(erc["step"])             c.step = erc["step"].as<double>();
+        if(erc["interval_ms"])      c.interval_ms = erc["interval_ms"].as<int>();
+        if(erc["hold_ms"])          c.hold_ms = erc["hold_ms"].as<int>();
+        if(erc["max_write_mb_s"])   c.max_write_mb_s = erc["max_write_mb_s"].as<double>();
+    }
+
+    if(node["raw_index_interval_us"]){
+        config.raw_index_interval_us = node["raw_index_interval_us"].as<int64_t>();
+    }
+
+    if(node["representations"]){
+        const YAML::Node &rep = node["representations"];
+        Representation_config &c = config.representations;
+        if(rep["enabled"])          c.enabled = rep["enabled"].as<bool>();
+        if(rep["time_surface"])     c.time_surface = rep["time_surface"].as<bool>();
+        if(rep["histogram"])        c.histogram = rep["histogram"].as<bool>();
+        if(rep["voxel"])            c.voxel = rep["voxel"].as<bool>();
+        if(rep["window_us"])        c.window_us = rep["window_us"].as<int>();
+        if(rep["bins"])             c.bins = rep["bins"].as<int>();
+        if(rep["tau_us"])           c.tau_us = rep["tau_us"].as<int>();
+        if(rep["publish_hz"])       c.publish_hz = rep["publish_hz"].as<double>();
+        if(rep["threads"])          c.threads = rep["threads"].as<int>();
+        if(rep["queue"])            c.queue = rep["queue"].as<uint32_t>();
+
+        // bins is the channel count of the voxel grid, each bin spans at least 1 us
+        if(c.bins < 1 || c.bins > CV_CN_MAX){
+            std::cerr << "representations.bins must be between 1 and " << CV_CN_MAX << ", got " << c.bins << std::endl;
+            throw "Invalid representations.bins";
+        }
+        if(c.window_us < c.bins){
+            std::cerr << "representations.window_us must be at least bins (" << c.bins << "), got " << c.window_us << std::endl;
+            throw "Invalid representations.window_us";
+        }
+        if(!(c.publish_hz > 0 && c.publish_hz <= 1e6)){
+            std::cerr << "representations.publish_hz must be above 0 and at most 1e6, got " << c.publish_hz << std::endl;
+            throw "Invalid representations.publish_hz";
+        }
+        if(c.threads < 1){
+            std::cerr << "representations.threads must be at least 1, got " << c.threads << std::endl;
+            throw "Invalid representations.threads";
+        }
+    }
+
+    if(node["hot_pixel_calibration_s"]){
+        config.hot_pixel_calibration_s = node["hot_pixel_calibration_s"].as<double>();
+    }
+
+    if(node["hot_pixel_threshold"]){
+        config.hot_pixel_threshold = node["hot_pixel_threshold"].as<double>();
+    }
+
+    if(node["hot_pixel_write_back"]){
+        config.hot_pixel_write_back = node["hot_pixel_write_back"].as<bool>();
+    }
+
+    if(node["event_queue"]){
+        config.event_queue = node["event_queue"].as<uint32_t>();
+    }
+
     if(node["crazy_pixels"]){
         for (const auto& node : node["crazy_pixels"]) {
             std::string pixelStr = node.as<std::string>();
@@ -185,13 +253,7 @@ std::atomic<bool> signal_caught{false};
 
 
 void Prophesee::prepare_recording(fs::path path){
-    std::string name;
-
-    if(config.master){
-        name =  "right.raw";
-    } else {
-        name =  "left.raw";
-    }
+    std::string name = std::string(this->name()) + ".raw";
     
     fs::path file(name);
 
@@ -201,38 +263,177 @@ void Prophesee::prepare_recording(fs::path path){
     // fs::create_directories(biases_output);
 
 
+    // storage_status() reads it with the mutex held
+    std::lock_guard<std::mutex> lock(mutex);
 	destination_path = path / name;
 
 }
 
 
 
+StorageStatus Prophesee::storage_status(){
+    fs::path raw_file;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        raw_file = destination_path;
+    }
+
+    // The SDK writes the RAW file itself, its size is all we can see
+    StorageStatus s;
+    boost::system::error_code ec;
+    uintmax_t size = fs::file_size(raw_file, ec);
+    if(!ec){
+        s.bytes_written = size;
+    }
+    return s;
+}
+
+// With erc_mutex held
+void Prophesee::set_erc_rate(uint32_t rate){
+    camera.erc_module().enable(true);
+    camera.erc_module().set_cd_event_rate(rate);
+    erc_current = rate;
+    metrics->gauge("prophexi_erc_rate", "ERC event rate applied to the sensor [ev/s]", metric_labels()).set(rate);
+}
+
+bool Prophesee::scale_erc(double factor){
+    std::lock_guard<std::mutex> lock(erc_mutex);
+    uint32_t current = erc_current ? erc_current : config.erc_rate;
+    erc_ceiling = current * factor;
+
+    set_erc_rate(erc_ceiling);
+    printf("\nProphesee %s: ERC rate lowered to %u ev/s\n", name(), erc_ceiling);
+    return true;
+}
+
+void Prophesee::reset_throttling(){
+    Device::reset_throttling();
+
+    std::lock_guard<std::mutex> lock(erc_mutex);
+    if(erc_ceiling){
+        camera.erc_module().enable(config.erc);
+        camera.erc_module().set_cd_event_rate(config.erc_rate);
+        erc_current = config.erc_rate;
+        erc_ceiling = 0;
+    }
+}
+
+
+// Masks the configured crazy pixels, as many as the sensor has masks for
+void Prophesee::apply_pixel_masks(){
+    Metavision::I_DigitalEventMask *digital_event_mask = camera.get_device().get_facility<Metavision::I_DigitalEventMask>();
+    if(!digital_event_mask){
+        if(!config.crazy_pixels.empty()){
+            printf("Prophesee %s: no digital event mask, crazy pixels not masked\n", name());
+        }
+        return;
+    }
+
+    auto masks = digital_event_mask->get_pixel_masks();
+    mask_capacity = masks.size();
+
+    size_t i = 0;
+    for (const auto &pixel : config.crazy_pixels) {
+        if(i >= masks.size()){
+            printf("Prophesee %s: only %zu pixel masks, %zu crazy pixels left unmasked\n",
+                   name(), masks.size(), config.crazy_pixels.size() - masks.size());
+            break;
+        }
+        masks[i]->set_mask(pixel.x, pixel.y, true);
+        i++;
+    }
+}
+
+
+// Ranks the pixels counted since start-up, masks the worst ones in the free masks and stores the
+// full list back in the config file. Pixels masked already produce no events and keep their masks.
+void Prophesee::calibrate_hot_pixels(const HotPixelCounter &counter){
+    size_t free_masks = mask_capacity > config.crazy_pixels.size() ? mask_capacity - config.crazy_pixels.size() : 0;
+    std::vector<HotPixel> hot = counter.rank(config.hot_pixel_threshold, free_masks);
+
+    uint64_t hot_events = 0;
+    for(const HotPixel &h : hot){
+        hot_events += h.count;
+        printf("  %4u %4u  %6u events  score %.1f\n", h.pixel.x, h.pixel.y, h.count, h.score);
+        config.crazy_pixels.push_back(h.pixel);
+    }
+    printf("Prophesee %s: %zu hot pixels (%zu masks free) produced %.1f%% of %lu events\n", name(), hot.size(), free_masks,
+           counter.total() ? 100.0 * hot_events / counter.total() : 0.0, (unsigned long)counter.total());
+
+    if(hot.empty()){
+        return;
+    }
+    apply_pixel_masks();
+
+    if(config.hot_pixel_write_back && !config.config_file.empty()){
+        try {
+            write_crazy_pixels(config.config_file, config.config_section, config.crazy_pixels);
+            printf("Prophesee %s: crazy_pixels written to %s\n", name(), config.config_file.c_str());
+        } catch(const char* err) {
+            std::cerr << "Prophesee " << name() << ": " << err << std::endl;
+        }
+    }
+}
+
+
+void Prophesee::report_callback_latency(uint64_t dropped){
+    LatencyStats::Summary s = cd_callback_latency.summary();
+    printf("Prophesee %s: CD callback %.2f us mean, %.2f us p99, %.2f us max over %lu buffers, %lu dropped\n",
+           name(), s.mean_us, s.p99_us, s.max_us, (unsigned long)s.count, (unsigned long)dropped);
+}
+
+
+
 void Prophesee::run(){
 
     // Get the geometry of the camera
     auto &geometry = camera.geometry(); // Get the geometry of the camera
 
+    // Scraped from the metrics endpoint, see metrics.hpp
+    std::string labels = metric_labels();
+    Gauge &rate_metric = metrics->gauge("prophexi_events_per_second", "CD event rate from the rate estimator", labels);
+    Gauge &peak_metric = metrics->gauge("prophexi_events_peak_per_second", "Peak CD event rate from the rate estimator", labels);
+    Counter &events_metric = metrics->counter("prophexi_events_total", "CD events decoded", labels);
+    Counter &dropped_metric = metrics->counter("prophexi_event_buffers_dropped_total", "CD buffers dropped by a full event queue", labels);
+
     // Setup CD event rate estimator
-    double avg_rate, peak_rate;
+    std::atomic<double> avg_rate{0}, peak_rate{0};
     Metavision::RateEstimator cd_rate_estimator(
-        [&avg_rate, &peak_rate](Metavision::timestamp ts, double arate, double prate) {
+        [&avg_rate, &peak_rate, &rate_metric, &peak_metric](Metavision::timestamp ts, double arate, double prate) {
             avg_rate  = arate;
             peak_rate = prate;
+            rate_metric.set(arate);
+            peak_metric.set(prate);
         },
         100000, 1000000, true);
 
-    // Setup CD frame generator
+    // Setup CD frame generator. The preview is rendered here, once per generated frame, and only
+    // while recording with a viewer attached.
     Metavision::CDFrameGenerator cd_frame_generator(geometry.width(), geometry.height());
     cd_frame_generator.set_display_accumulation_time_us(100000);
 
-    std::mutex cd_frame_mutex;
-    cv::Mat cd_frame;
-    Metavision::timestamp cd_frame_ts{0};
+    long long generated_frames = 0;
     cd_frame_generator.start(
-        30, [&cd_frame_mutex, &cd_frame, &cd_frame_ts](const Metavision::timestamp &ts, const cv::Mat &frame) {
-            std::unique_lock<std::mutex> lock(cd_frame_mutex);
-            cd_frame_ts = ts;
-            frame.copyTo(cd_frame);
+        30, [this, &generated_frames, &avg_rate](const Metavision::timestamp &ts, const cv::Mat &frame) {
+            if (paused || frame.empty() || !preview.wanted()) {
+                return;
+            }
+            if (++generated_frames % preview_interval != 0) {
+                return;
+            }
+
+            std::string text;
+
+            text = human_readable_time(ts);
+            
+            text += "     ";
+            text += human_readable_rate(avg_rate);
+
+            preview.try_publish([&frame, &text](cv::Mat &out) {
+                frame.copyTo(out);
+                cv::putText(out, text, cv::Point(10, 20), cv::FONT_HERSHEY_PLAIN, 1, cv::Scalar(108, 143, 255), 1,
+                            cv::LINE_AA);
+            });
         });
 
     // Setup CD frame display
@@ -253,81 +454,238 @@ void Prophesee::run(){
 //     cv::setWindowProperty(cd_window_name, cv::WND_PROP_TOPMOST, 1);
 // #endif
 
-    // Setup camera CD callback to update the frame generator and event rate estimator
+    // The CD callback only copies the buffer into the queue, frame generation and rate estimation
+    // run on the consumer thread so the SDK's decoding thread never waits for them
+    EventQueue<Metavision::EventCD> cd_queue(config.event_queue, 4096);
     int cd_events_cb_id =
-        camera.cd().add_callback([&cd_frame_mutex, &cd_frame_generator, &cd_rate_estimator](
-                                        const Metavision::EventCD *ev_begin, const Metavision::EventCD *ev_end) {
-            std::unique_lock<std::mutex> lock(cd_frame_mutex);
-            cd_frame_generator.add_events(ev_begin, ev_end);
-            cd_rate_estimator.add_data(std::prev(ev_end)->t, std::distance(ev_begin, ev_end));
+        camera.cd().add_callback([this, &cd_queue](const Metavision::EventCD *ev_begin, const Metavision::EventCD *ev_end) {
+            auto start = std::chrono::steady_clock::now();
+            cd_queue.push(ev_begin, ev_end);
+            cd_callback_latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        });
+
+    // The Ximea GPO drives the trigger input, its edges are matched to the frames
+    int trigger_cb_id = -1;
+    if(clock_sync){
+        trigger_cb_id = camera.ext_trigger().add_callback(
+            [this](const Metavision::EventExtTrigger *ev_begin, const Metavision::EventExtTrigger *ev_end) {
+                long long host_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+                for(auto ev = ev_begin; ev != ev_end; ++ev){
+                    clock_sync->add_trigger(ev->t, ev->p, host_us);
+                }
+            });
+    }
+
+    // Per-pixel counts while calibrating hot pixels
+    std::unique_ptr<HotPixelCounter> hot_pixel_counter;
+    std::mutex hot_pixel_mutex;
+    if(config.hot_pixel_calibration_s > 0){
+        hot_pixel_counter.reset(new HotPixelCounter(geometry.width(), geometry.height()));
+    }
+
+    std::atomic<bool> consuming{true};
+    std::atomic<int64_t> last_event_ts{0};
+    std::thread cd_consumer([&consuming, &cd_queue, &cd_frame_generator, &cd_rate_estimator, &last_event_ts,
+                             &hot_pixel_counter, &hot_pixel_mutex, &events_metric, &dropped_metric]() {
+        uint64_t dropped = 0;
+        while(consuming){
+            cd_queue.wait(std::chrono::milliseconds(100));
+
+            uint64_t now_dropped = cd_queue.dropped();
+            dropped_metric.add(now_dropped - dropped);
+            dropped = now_dropped;
+
+            while(const std::vector<Metavision::EventCD> *chunk = cd_queue.front()){
+                events_metric.add(chunk->size());
+                if(!chunk->empty()){
+                    cd_frame_generator.add_events(chunk->data(), chunk->data() + chunk->size());
+                    cd_rate_estimator.add_data(chunk->back().t, chunk->size());
+                    last_event_ts.store(chunk->back().t, std::memory_order_relaxed);
+
+                    std::lock_guard<std::mutex> lock(hot_pixel_mutex);
+                    if(hot_pixel_counter){
+                        hot_pixel_counter->add(chunk->data(), chunk->data() + chunk->size());
+                    }
+                }
+                cd_queue.pop();
+            }
+        }
+    });
+
+    // The representation engine gets its own copy of the CD buffers and its own thread
+    std::unique_ptr<EventQueue<Metavision::EventCD>> rep_queue;
+    std::thread rep_worker;
+    if(representation_engine){
+        rep_queue.reset(new EventQueue<Metavision::EventCD>(config.representations.queue, 4096));
+        camera.cd().add_callback([&rep_queue](const Metavision::EventCD *ev_begin, const Metavision::EventCD *ev_end) {
+            rep_queue->push(ev_begin, ev_end);
+        });
+        rep_worker = std::thread([this, &consuming, &rep_queue]() {
+            while(consuming){
+                rep_queue->wait(std::chrono::milliseconds(100));
+                while(const std::vector<Metavision::EventCD> *chunk = rep_queue->front()){
+                    representation_engine->process(chunk->data(), chunk->data() + chunk->size());
+                    rep_queue->pop();
+                }
+            }
         });
+    }
 
 
 
 
 
 		
-    // Start the camera streaming
+    // Start the camera streaming, a master only once its slaves stream
+    wait_for_dependencies();
     camera.start();
+    mark_ready();
+
+    if(hot_pixel_counter){
+        printf("Prophesee %s: counting hot pixels for %.0f s, keep the sensor still\n", name(), config.hot_pixel_calibration_s);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait_for(lock, std::chrono::duration<double>(config.hot_pixel_calibration_s), [this]() { return (bool)stopped; });
+        lock.unlock();
+
+        std::lock_guard<std::mutex> counter_lock(hot_pixel_mutex);
+        calibrate_hot_pixels(*hot_pixel_counter);
+        hot_pixel_counter.reset();
+    }
 
     printf("Prophesee %s - %s ready\n", config.master? "Master" : "Slave", config.serial.c_str());
 
 
+    // Adaptive ERC, every change goes to <name>_erc.csv next to the RAW file
+    ErcController erc_controller(config.erc_control);
+    FILE *erc_log = nullptr;
+    uint64_t last_raw_bytes = 0;
+    auto last_erc_check = std::chrono::steady_clock::now();
+
+    auto log_erc = [&](double measured, double write_mb_s, uint32_t old_rate, uint32_t new_rate, const char *reason) {
+        int64_t system_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        fprintf(erc_log, "%ld,%ld,%.0f,%.2f,%u,%u,%s\n", (long)system_us, (long)last_event_ts.load(),
+                measured, write_mb_s, old_rate, new_rate, reason);
+        fflush(erc_log);
+    };
+
+    auto adapt_erc = [&]() {
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now - last_erc_check).count();
+        last_erc_check = now;
+
+        uint64_t raw_bytes = storage_status().bytes_written;
+        double write_mb_s = dt > 0 && raw_bytes >= last_raw_bytes ? (raw_bytes - last_raw_bytes) / dt / 1e6 : 0;
+        last_raw_bytes = raw_bytes;
+
+        std::lock_guard<std::mutex> erc_lock(erc_mutex);
+        std::string reason;
+        double measured = avg_rate;
+        uint32_t rate = erc_controller.update(std::chrono::duration<double>(now.time_since_epoch()).count(),
+                                              measured, write_mb_s, erc_current, erc_ceiling, reason);
+        if(rate != erc_current){
+            log_erc(measured, write_mb_s, erc_current, rate, reason.c_str());
+            set_erc_rate(rate);
+        }
+    };
+
+
+    // The thread only wakes up for start_recording(), stop_recording(), stop() and the ERC controller
+    std::unique_lock<std::mutex> lock(mutex);
     while(camera.is_running()){
 		
 		// Wait here for recording to start
-		std::unique_lock<std::mutex> lock(mutex);
-
-		condition.wait(lock);
+		condition.wait(lock, [this]() { return !paused || stopped; });
 		if(stopped){
 			break;
 		}
-		lock.unlock();
 
-        
-
-        camera.start_recording(destination_path.string());
-
-		// Frame aquisition 
-		while(true){
-			
-            if (!cd_frame.empty()) {
-                    std::unique_lock<std::mutex> lock(cd_frame_mutex);
-                    std::string text;
-
-                    text = human_readable_time(cd_frame_ts);
-                    
-                    text += "     ";
-                    text += human_readable_rate(avg_rate);
-                    cv::putText(cd_frame, text, cv::Point(10, 20), cv::FONT_HERSHEY_PLAIN, 1, cv::Scalar(108, 143, 255), 1,
-                                cv::LINE_AA);
-                    // cv::imshow(cd_window_name, cd_frame);
-
-                    {
-                        std::lock_guard<std::mutex> lock(frame_mutex);
-                        out_frame = cd_frame.clone();
-                    }
+        fs::path raw_file = destination_path;
+        lock.unlock();
 
+        // The SDK opens the RAW file itself when recording starts, only the ERC log can be opened early
+        if(config.erc_control.enabled){
+            erc_log = fopen((raw_file.parent_path() / (std::string(name()) + "_erc.csv")).c_str(), "w");
+            if(erc_log){
+                fprintf(erc_log, "system_us,event_ts_us,measured_ev_s,write_mb_s,old_rate,new_rate,reason\n");
             }
+        }
+        if(!wait_for_commit()){
+            if(erc_log){
+                fclose(erc_log);
+                erc_log = nullptr;
+            }
+            mark_drained();
+            lock.lock();
+            continue;
+        }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
-
-			{
-				std::lock_guard<std::mutex> lock(mutex);
-
-				if(stopped || paused){
-					// Stop Aquisition
-                    camera.stop_recording();
-					break;
-				}
-			}
-		}
+        camera.start_recording(raw_file.string());
+        mark_capture_start();
+        if(raw_indexer){
+            raw_indexer->start(raw_file.string());
+        }
+        cd_callback_latency.reset();
+        uint64_t dropped_at_start = cd_queue.dropped();
+        lock.lock();
+
+		// Frame aquisition happens in the camera callbacks
+        if(config.erc_control.enabled){
+            if(erc_log){
+                std::lock_guard<std::mutex> erc_lock(erc_mutex);
+                log_erc(avg_rate, 0, erc_current, erc_current, "start");
+            }
+            erc_controller.reset();
+            last_raw_bytes = 0;
+            last_erc_check = std::chrono::steady_clock::now();
+
+            while(!condition.wait_for(lock, std::chrono::milliseconds(config.erc_control.interval_ms),
+                                      [this]() { return paused || stopped; })){
+                lock.unlock();
+                if(erc_log){
+                    adapt_erc();
+                }
+                lock.lock();
+            }
+        } else {
+            condition.wait(lock, [this]() { return paused || stopped; });
+        }
 
+		// Stop Aquisition
+        lock.unlock();
+        mark_capture_end();
+        camera.stop_recording();
+        if(raw_indexer){
+            raw_indexer->stop();
+        }
+        report_callback_latency(cd_queue.dropped() - dropped_at_start);
+        if(erc_log){
+            fclose(erc_log);
+            erc_log = nullptr;
+        }
+        mark_drained();
+        lock.lock();
 	}
+    lock.unlock();
 
+    if(trigger_cb_id >= 0){
+        camera.ext_trigger().remove_callback(trigger_cb_id);
+    }
     camera.stop();
 
+    consuming = false;
+    cd_queue.wake();
+    cd_consumer.join();
+    if(rep_worker.joinable()){
+        rep_queue->wake();
+        rep_worker.join();
+    }
+
+    cd_frame_generator.stop();
+
 }
 
 
@@ -337,10 +695,16 @@ void Prophesee::init(){
 
         
     try {
-        if (!config.serial.empty()) {
-            camera = Metavision::Camera::from_serial(config.serial);
-        } else {
-            camera = Metavision::Camera::from_first_available();
+        {
+            // Devices initialize in parallel, only the discovery is serialized so two cameras without
+            // a serial never pick the same sensor
+            static std::mutex open_mutex;
+            std::lock_guard<std::mutex> open_lock(open_mutex);
+            if (!config.serial.empty()) {
+                camera = Metavision::Camera::from_serial(config.serial);
+            } else {
+                camera = Metavision::Camera::from_first_available();
+            }
         }
 
         if (config.biases_file != "") {
@@ -371,14 +735,7 @@ void Prophesee::init(){
             }
         }
 
-        Metavision::I_DigitalEventMask *digital_event_mask = camera.get_device().get_facility<Metavision::I_DigitalEventMask>();
-        auto masks = digital_event_mask->get_pixel_masks();
-        int i = 0;
-        for (const auto &pixel : config.crazy_pixels) {
-            // std::cout << "Masking pixel {" << pixel.x << "," << pixel.y << "} - no event will be generated by this pixel \n";
-            masks[i]->set_mask(pixel.x, pixel.y, true);
-            i++;
-        }
+        apply_pixel_masks();
 
         camera_is_opened = true;
     } catch (Metavision::CameraException &e) { MV_LOG_ERROR() << e.what(); }
@@ -393,6 +750,21 @@ void Prophesee::init(){
 
     camera.erc_module().enable(config.erc);
     camera.erc_module().set_cd_event_rate(config.erc_rate);
+    erc_current = config.erc_rate;
+
+    if(config.raw_index_interval_us > 0){
+        raw_indexer.reset(new RawIndexer(config.raw_index_interval_us));
+    }
+
+    if(config.representations.enabled && camera_is_opened){
+        auto &geometry = camera.geometry();
+        representation_engine.reset(new RepresentationEngine(geometry.width(), geometry.height(), config.representations));
+    }
+
+    if(config.erc_control.enabled && !config.erc){
+        printf("Prophesee %s: adaptive ERC needs ERC enabled, disabled\n", name());
+        config.erc_control.enabled = false;
+    }
 
 
     // Add runtime error callback
@@ -31,6 +31,8 @@
 #include <iomanip>
 #include <thread> 
 #include <string> 
+#include <functional>
+#include <mutex>
 #include <opencv2/core.hpp> 
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgcodecs.hpp>
@@ -47,6 +49,11 @@
 #include "ui.hpp"
 #include "ximea.hpp"
 #include "device.hpp"
+#include "storage_controller.hpp"
+#include "device_registry.hpp"
+#include "session_stager.hpp"
+#include "metrics.hpp"
+#include "clock_sync.hpp"
 
 
 
@@ -57,7 +64,8 @@ namespace fs = boost::filesystem;
 
 
 
-fs::path prepare_new_directory(const std::string &output_dir, const std::string &note){
+// Session directories are <date>_<time>_<note>, created by the SessionStager
+std::string session_name(const std::string &note){
 
     time_t     now = time(0);
     struct tm  tstruct;
@@ -71,41 +79,78 @@ fs::path prepare_new_directory(const std::string &output_dir, const std::string
     char file_name[256];
     snprintf(file_name, 255, "%s_%s", file_name_time, note.c_str());
 
-     
-    fs::path dir (output_dir);
-    fs::path sub_dir (file_name);
-    fs::path full_path = dir / sub_dir;
-    fs::create_directories(full_path);
-
-    return full_path;
+    return file_name;
 }
 
 
 
-void load_prophexi_config_file(std::string config_yaml_file, Ximea_config &xi_config, Prophesee_config &proph_R_config, Prophesee_config &proph_L_config){
+void load_prophexi_config_file(std::string config_yaml_file, DeviceRegistry &devices,
+                               StorageController_config &storage_config, ClockSync_config &clock_config,
+                               ThreadPlacement_config &ui_placement, Metrics_config &metrics_config){
     std::ifstream yaml_fstream(config_yaml_file);
     YAML::Node config = YAML::Load(yaml_fstream);
 
-    if (config["ximea"]) {
-        if (config["ximea"]["fps"])
-            xi_config.fps = config["ximea"]["fps"].as<int>();
-        if (config["ximea"]["ae_max_lim"])
-            xi_config.ae_max_lim = config["ximea"]["ae_max_lim"].as<int>();
-        if (config["ximea"]["ag_max_lim"])
-            xi_config.ag_max_lim = config["ximea"]["ag_max_lim"].as<float>();
-        if (config["ximea"]["aeag_level"])
-            xi_config.aeag_level = config["ximea"]["aeag_level"].as<int>();
-        if (config["ximea"]["exp_priority"])    
-            xi_config.exp_priority = config["ximea"]["exp_priority"].as<float>();
-        if (config["ximea"]["ae_manual"])
-            xi_config.ae_enabled = !config["ximea"]["ae_manual"].as<bool>();
+    if (config["storage"]) {
+        const YAML::Node &storage = config["storage"];
+        if (storage["enabled"])
+            storage_config.enabled = storage["enabled"].as<bool>();
+        if (storage["interval_ms"])
+            storage_config.interval_ms = storage["interval_ms"].as<int>();
+        if (storage["queue_high"])
+            storage_config.queue_high = storage["queue_high"].as<double>();
+        if (storage["sustain"])
+            storage_config.sustain = storage["sustain"].as<int>();
+        if (storage["hold_s"])
+            storage_config.hold_s = storage["hold_s"].as<int>();
+        if (storage["min_free_gb"])
+            storage_config.min_free_gb = storage["min_free_gb"].as<double>();
+        if (storage["min_remaining_s"])
+            storage_config.min_remaining_s = storage["min_remaining_s"].as<double>();
+        if (storage["steps"]) {
+            storage_config.steps.clear();
+            for (const auto &step : storage["steps"])
+                storage_config.steps.push_back(degrade_step_from_string(step.as<std::string>()));
+        }
+        if (storage["preview_interval"])
+            storage_config.preview_interval = storage["preview_interval"].as<int>();
+        if (storage["ximea_decimation"])
+            storage_config.ximea_decimation = storage["ximea_decimation"].as<int>();
+        if (storage["erc_factor"])
+            storage_config.erc_factor = storage["erc_factor"].as<double>();
     }
 
-    if (config["ev_right"])
-        set_prophesee_config( proph_R_config, config["ev_right"]);
+    if (config["clock_sync"]) {
+        const YAML::Node &clock = config["clock_sync"];
+        if (clock["enabled"])
+            clock_config.enabled = clock["enabled"].as<bool>();
+        if (clock["camera"])
+            clock_config.camera = clock["camera"].as<std::string>();
+        if (clock["ximea"])
+            clock_config.ximea = clock["ximea"].as<std::string>();
+        if (clock["start_polarity"])
+            clock_config.start_polarity = clock["start_polarity"].as<int>();
+        if (clock["tolerance_us"])
+            clock_config.tolerance_us = clock["tolerance_us"].as<int>();
+        if (clock["fit_pairs"])
+            clock_config.fit_pairs = clock["fit_pairs"].as<int>();
+        if (clock["acquire_frames"])
+            clock_config.acquire_frames = clock["acquire_frames"].as<int>();
+    }
+
+    if (config["metrics"]) {
+        const YAML::Node &metrics = config["metrics"];
+        if (metrics["enabled"])
+            metrics_config.enabled = metrics["enabled"].as<bool>();
+        if (metrics["port"])
+            metrics_config.port = metrics["port"].as<int>();
+        if (metrics["unix_socket"])
+            metrics_config.unix_socket = metrics["unix_socket"].as<std::string>();
+    }
 
-    if (config["ev_left"])
-        set_prophesee_config( proph_L_config, config["ev_left"]);
+    if (config["ui_placement"])
+        set_placement_config(ui_placement, config["ui_placement"]);
+
+    devices.load(config_yaml_file, config);
 
 }
 
@@ -116,12 +161,17 @@ int main(int argc, char *argv[]) {
     Ximea_config xi_config;
     Prophesee_config proph_R_config;
     Prophesee_config proph_L_config;
+    StorageController_config storage_config;
+    ClockSync_config clock_config;
+    ThreadPlacement_config ui_placement;
+    Metrics_config metrics_config;
 
     bool run_gui;
     bool manual_ae;
     std::string output_dir;
     std::string note;
     std::string config_yaml_file;
+    double calibrate_hot_pixels;
 
     const std::string short_program_desc(
         "Simple Synchronour recorder of IMU and Event Camera.\n");
@@ -164,6 +214,7 @@ int main(int argc, char *argv[]) {
         // ("imu-out,m", po::value<std::string>(&out_imu_file_path)->default_value("imu"), "Folder to output IMU file used for data recording. Default value is 'imu'.")
         ("erc",              po::bool_switch(&proph_L_config.erc)->default_value(true), "ERC on prophesee cameras")
         ("erc_rate",         po::value<uint32_t>(&proph_L_config.erc_rate)->default_value(100), "ERC Rate Mev/s")
+        ("calibrate_hot_pixels", po::value<double>(&calibrate_hot_pixels)->default_value(0), "Count events for this many seconds at start-up and mask the hot pixels")
     ;
     // clang-format on
 
@@ -194,46 +245,100 @@ int main(int argc, char *argv[]) {
 
     // load Prophesee config file
 
-    load_prophexi_config_file(config_yaml_file, xi_config, proph_R_config, proph_L_config);
-   
-    // ERC is the same for both cameras
+    // ERC is the same for all cameras, the command line values are defaults for the config file
     proph_R_config.erc = proph_L_config.erc;
-    proph_L_config.erc_rate *= 1000000;
     proph_R_config.erc_rate = proph_L_config.erc_rate;
-    xi_config.ae_enabled = !manual_ae;
-
+    DeviceRegistry devices(xi_config, proph_R_config, proph_L_config);
 
-    MV_LOG_INFO() << short_program_desc;
+    try {
+        load_prophexi_config_file(config_yaml_file, devices, storage_config, clock_config, ui_placement, metrics_config);
+    } catch (const char* err) {
+        std::cerr << "Config: " << err << std::endl;
+        return 1;
+    }
 
-    if (vm.count("roi")) {
-        if (proph_R_config.roi.size() != 4) {
+    for (Prophesee_config *c : devices.prophesee_configs()) {
+        c->erc = proph_L_config.erc;
+        c->erc_rate = proph_L_config.erc_rate * 1000000;
+        if (calibrate_hot_pixels > 0) {
+            c->hot_pixel_calibration_s = calibrate_hot_pixels;
+        }
+        if (!c->roi.empty() && c->roi.size() != 4) {
             MV_LOG_WARNING() << "ROI as argument must be in the format 'x y width height '. ROI has not been set.";
-            proph_R_config.roi.clear();
+            c->roi.clear();
         }
     }
+    for (Ximea_config *c : devices.ximea_configs()) {
+        c->ae_enabled = !manual_ae;
+    }
 
 
+    MV_LOG_INFO() << short_program_desc;
 
-    // return 0;
-    Ximea xi_cam(xi_config);
-    Prophesee proph_R_cam(proph_R_config);
-    Prophesee proph_L_cam(proph_L_config);
 
+    // Maps the Ximea frames onto the clock of the camera that sees the GPO
+    ClockSync clock(clock_config);
 
-    std::vector<Device*> cameras = {&xi_cam, &proph_L_cam, &proph_R_cam};
+    devices.create();
+    devices.print_budgets();
 
+    std::vector<Device*> &cameras = devices.devices();
 
-    xi_cam.start();
-    proph_L_cam.start();
-    std::this_thread::sleep_for(std::chrono::milliseconds(1000)); // Give Master time to turn on
-    proph_R_cam.start();
+    if (clock_config.enabled) {
+        Ximea *ximea = devices.find_ximea(clock_config.ximea);
+        Prophesee *prophesee = devices.find_prophesee(clock_config.camera);
+        if (ximea && prophesee) {
+            ximea->set_clock_sync(&clock);
+            prophesee->set_clock_sync(&clock);
+        } else {
+            std::cerr << "Clock sync: no devices " << clock_config.ximea << " and " << clock_config.camera << ", disabled" << std::endl;
+        }
+    }
 
+    // Live per-device counters for Prometheus, scraped from localhost
+    MetricsRegistry metrics;
+    devices.register_metrics(metrics);
+    MetricsServer metrics_server(metrics, metrics_config);
+    if (metrics_config.enabled) {
+        metrics_server.start();
+    }
 
-    UI ui(cameras);
+    devices.start();
+
+    // The next session directory and its outputs are prepared while nothing records
+    SessionStager stager(output_dir, cameras);
+    stager.stage();
+
+    UI ui(cameras, ui_placement);
 
     ui.start();
 
+    // Sessions are ended from the prompt or by the StorageController
+    std::mutex session_mutex;
     bool recording = false;
+    std::function<void()> stop_session;
+
+    StorageController storage(storage_config, cameras, [&stop_session]() { stop_session(); });
+
+    stop_session = [&]() {
+        std::lock_guard<std::mutex> lock(session_mutex);
+        if (!recording) {
+            return;
+        }
+
+        devices.stop_recording();
+        clock.end_session();
+
+        std::system("pkill -f arecord");
+
+        storage.end_session();
+
+        std::cout << "Stopped recording." << std::endl;
+        recording = false;
+        stager.stage();
+    };
+
+    storage.start();
 
     while (true) {
         std::string input;
@@ -241,13 +346,14 @@ int main(int argc, char *argv[]) {
         if (input == "q" || input == "quit"){
             std::cout << "Quitting" << std::endl;
 
+            storage.stop();
             ui.stop();
 
-            xi_cam.stop();
-            proph_R_cam.stop();
-            proph_L_cam.stop(); 
+            devices.stop();
+            metrics_server.stop();
             return 0;
         } else {
+            std::unique_lock<std::mutex> lock(session_mutex);
             if (!recording) {
 
                 std::string note;
@@ -259,7 +365,7 @@ int main(int argc, char *argv[]) {
                     note = "recording";
                 }
 
-                fs::path new_path = prepare_new_directory(output_dir, note);
+                fs::path new_path = stager.take(session_name(note));
 
                 char message[2048];
                 std::snprintf(message, sizeof(message), "arecord -f S32_LE -c 1 -r 44100 -t wav -d 0 -q %s/recording.wav &", new_path.c_str());
@@ -267,27 +373,19 @@ int main(int argc, char *argv[]) {
                 
                 
 
-                proph_L_cam.start_recording(new_path);
-                proph_R_cam.start_recording(new_path);
-                
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-       
-                xi_cam.start_recording(new_path);
+                clock.start_session(new_path.string());
+                if (!devices.start_recording(new_path)) {
+                    clock.end_session();
+                    std::system("pkill -f arecord");
+                    stager.stage();
+                    continue;
+                }
+                storage.start_session(new_path);
                 std::cout << "Recording started in " << new_path.string() << std::endl;
                 recording = true;
             } else {
-
-                xi_cam.stop_recording();
-
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                
-                proph_R_cam.stop_recording();
-                proph_L_cam.stop_recording();
-
-                std::system("pkill -f arecord");
-
-                std::cout << "Stopped recording." << std::endl;
-                recording = false;
+                lock.unlock();
+                stop_session();
             }
         }
     }
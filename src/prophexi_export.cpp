@@ -0,0 +1,185 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this 
+ * software and associated documentation files (the “Software”), to deal in the Software 
+ * without restriction, including without limitation the rights to use, copy, modify, merge, 
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit 
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+// Converts a frame container (<name>.pxf) back into the one-TIFF-per-frame layout and the binary
+// frame log (<name>_ts.bin) into <name>_ts.csv. A session directory exports every container and
+// log in it, and its clock table (ximea_event_time.bin) becomes ximea_event_time.csv
+//   prophexi_export <session_dir | <name>.pxf | <name>_ts.bin> [-o output_dir] [--keep_alignment]
+
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "frame_container.hpp"
+#include "frame_log.hpp"
+#include "clock_sync.hpp"
+#include "frame_sink.hpp"
+#include "bit_align.hpp"
+
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+
+
+// Frames of one container as frame%06d.tif in output_dir
+static void export_container(const fs::path &container_path, const std::string &output_dir, bool keep_alignment) {
+    FrameContainerReader reader(container_path.string());
+
+    if (!reader.has_index()) {
+        std::cerr << "Warning: " << container_path.string() << " has no index (recording not closed), recovered "
+                  << reader.size() << " frames from the chunks" << std::endl;
+    }
+
+    fs::create_directories(output_dir);
+
+    const ContainerHeader &hdr = reader.header();
+
+    // Recordings made with msb_align: false are shifted here to match what WriteImage() always wrote
+    int shift = 0;
+    int significant_bits = 0;
+    if (hdr.significant_bits > 0 && hdr.significant_bits < 16 && hdr.cv_type == CV_16UC1) {
+        if (keep_alignment) {
+            significant_bits = hdr.significant_bits + hdr.bit_shift;
+        } else {
+            shift = 16 - hdr.significant_bits - hdr.bit_shift;
+        }
+    }
+    cv::Mat aligned(hdr.height, hdr.width, CV_16UC1);
+    cv::Mat decoded;
+
+    for (size_t i = 0; i < reader.size(); i++) {
+        char filename[100] = "";
+        sprintf(filename, "frame%06d.tif", reader.record(i).frame_id);
+
+        fs::path img_path = fs::path(output_dir) / fs::path(filename);
+
+        cv::Mat image;
+        if (hdr.pixel_format == CONTAINER_PIXELS_RAW && hdr.codec == (uint32_t)Codec::NONE) {
+            image = reader.image(i);
+        } else {
+            reader.decode(i, decoded);
+            image = decoded;
+        }
+
+        if (shift > 0) {
+            shift_left_u16((const uint16_t*)image.data, (uint16_t*)aligned.data, image.total(), shift);
+            image = aligned;
+        }
+        WriteImage(image, img_path.c_str(), significant_bits < 16 ? significant_bits : 0);
+
+        if (i % 64 == 0) {
+            printf("\rExported %zu/%zu", i + 1, reader.size());
+            fflush(stdout);
+        }
+    }
+    printf("\rExported %zu frames to %s\n", reader.size(), output_dir.c_str());
+}
+
+
+
+int main(int argc, char *argv[]) {
+
+    std::string input;
+    std::string output_dir;
+    bool keep_alignment;
+
+    po::options_description options_desc("Options");
+    // clang-format off
+    options_desc.add_options()
+        ("help,h", "Produce help message.")
+        ("input,i",         po::value<std::string>(&input), "Recording directory, .pxf container or .bin frame log")
+        ("output_dir,o",    po::value<std::string>(&output_dir), "Output directory, defaults to <recording>/<name> for <name>.pxf")
+        ("keep_alignment",  po::bool_switch(&keep_alignment)->default_value(false), "Do not MSB align frames recorded with msb_align: false")
+    ;
+    // clang-format on
+
+    po::positional_options_description positional;
+    positional.add("input", 1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(options_desc).positional(positional).run(), vm);
+        po::notify(vm);
+    } catch (po::error &e) {
+        std::cerr << options_desc << std::endl;
+        std::cerr << "Parsing error:" << e.what() << std::endl;
+        return 1;
+    }
+
+    if (vm.count("help") || input.empty()) {
+        std::cout << options_desc << std::endl;
+        return vm.count("help") ? 0 : 1;
+    }
+
+    // Every Ximea of a session writes <name>.pxf (container sink) and <name>_ts.bin
+    std::vector<fs::path> containers;
+    std::vector<fs::path> logs;
+    fs::path input_path(input);
+    if (fs::is_directory(input_path)) {
+        for (const fs::directory_entry &entry : fs::directory_iterator(input_path)) {
+            const fs::path &p = entry.path();
+            const std::string filename = p.filename().string();
+            if (p.extension() == ".pxf") {
+                containers.push_back(p);
+            } else if (filename.size() > 7 && filename.compare(filename.size() - 7, 7, "_ts.bin") == 0) {
+                logs.push_back(p);
+            }
+        }
+        std::sort(containers.begin(), containers.end());
+        std::sort(logs.begin(), logs.end());
+    } else if (input_path.extension() == ".bin") {
+        logs.push_back(input_path);
+    } else {
+        containers.push_back(input_path);
+    }
+
+    try {
+        for (const fs::path &log_path : logs) {
+            fs::path csv_path = log_path.parent_path() / (log_path.stem().string() + ".csv");
+            frame_log_to_csv(log_path.string(), csv_path.string());
+            printf("Wrote %s\n", csv_path.c_str());
+        }
+        fs::path clock_path = input_path / "ximea_event_time.bin";
+        if (fs::is_directory(input_path) && fs::exists(clock_path)) {
+            fs::path csv_path = clock_path.parent_path() / "ximea_event_time.csv";
+            clock_table_to_csv(clock_path.string(), csv_path.string());
+            printf("Wrote %s\n", csv_path.c_str());
+        }
+
+        // Frames go to <recording>/<name>, or <output_dir>/<name> when one directory is given for several containers
+        for (const fs::path &container_path : containers) {
+            std::string frames_dir = output_dir;
+            if (frames_dir.empty()) {
+                frames_dir = (container_path.parent_path() / container_path.stem()).string();
+            } else if (containers.size() > 1) {
+                frames_dir = (fs::path(output_dir) / container_path.stem()).string();
+            }
+            export_container(container_path, frames_dir, keep_alignment);
+        }
+    } catch (const char* err) {
+        std::cerr << "Error: " << err << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
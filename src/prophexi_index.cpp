@@ -0,0 +1,120 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+// Builds the seek index (<file>.raw.idx) of Prophesee RAW recordings made before they were indexed
+// while recording, and reads time windows through it
+//   prophexi_index <session_dir | file.raw>... [-j threads] [--interval_us 10000] [--query t0 t1]
+
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "raw_index.hpp"
+
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+
+
+int main(int argc, char *argv[]) {
+
+    std::vector<std::string> inputs;
+    int threads;
+    int64_t interval_us;
+    std::vector<int64_t> query;
+
+    po::options_description options_desc("Options");
+    // clang-format off
+    options_desc.add_options()
+        ("help,h", "Produce help message.")
+        ("input,i",         po::value<std::vector<std::string>>(&inputs), "Recording directories or .raw files")
+        ("threads,j",       po::value<int>(&threads)->default_value(std::thread::hardware_concurrency()), "Threads scanning each file")
+        ("interval_us",     po::value<int64_t>(&interval_us)->default_value(10000), "Time between index entries [us]")
+        ("query",           po::value<std::vector<int64_t>>(&query)->multitoken(), "Decode the events in [t0, t1) through the index instead")
+    ;
+    // clang-format on
+
+    po::positional_options_description positional;
+    positional.add("input", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(options_desc).positional(positional).run(), vm);
+        po::notify(vm);
+    } catch (po::error &e) {
+        std::cerr << options_desc << std::endl;
+        std::cerr << "Parsing error:" << e.what() << std::endl;
+        return 1;
+    }
+
+    if (vm.count("help") || inputs.empty() || (!query.empty() && query.size() != 2)) {
+        std::cout << options_desc << std::endl;
+        return vm.count("help") ? 0 : 1;
+    }
+
+    std::vector<fs::path> raw_files;
+    for (const std::string &input : inputs) {
+        if (fs::is_directory(input)) {
+            for (const auto &entry : fs::directory_iterator(input)) {
+                if (entry.path().extension() == ".raw") {
+                    raw_files.push_back(entry.path());
+                }
+            }
+        } else {
+            raw_files.push_back(input);
+        }
+    }
+
+    int failed = 0;
+    for (const fs::path &raw : raw_files) {
+        try {
+            if (!query.empty()) {
+                RawEventReader reader(raw.string());
+                if (!reader.has_index()) {
+                    std::cerr << "Warning: " << raw.string() << " has no index, decoding from the start" << std::endl;
+                }
+
+                std::vector<RawEvent> events;
+                auto start = std::chrono::steady_clock::now();
+                reader.read(query[0], query[1], events);
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+                printf("%s: %zu events in [%ld, %ld), %zu bytes decoded in %.2f ms\n", raw.c_str(), events.size(),
+                       (long)query[0], (long)query[1], reader.last_decoded_bytes(), ms);
+                continue;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            size_t entries = build_raw_index(raw.string(), interval_us, threads);
+            double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            printf("%s: %zu entries, %.1f MB/s\n", raw_index_path(raw.string()).c_str(), entries,
+                   fs::file_size(raw) / s / 1e6);
+        } catch (const char* err) {
+            std::cerr << raw.string() << ": " << err << std::endl;
+            failed++;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,485 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "raw_index.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Stream words are little endian, TIME_HIGH carries the timestamp above `shift` bits
+static size_t word_size(RawFormat format){
+    return format == RawFormat::EVT2 ? 4 : 2;
+}
+
+static int time_shift(RawFormat format){
+    return format == RawFormat::EVT2 ? 6 : 12;
+}
+
+// Timestamps wrap after this many microseconds
+static int64_t time_range(RawFormat format){
+    return format == RawFormat::EVT2 ? (int64_t)1 << 34 : (int64_t)1 << 24;
+}
+
+static inline uint32_t read_word(const uint8_t *p, RawFormat format){
+    if(format == RawFormat::EVT2){
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+    return p[0] | (p[1] << 8);
+}
+
+// TIME_HIGH value of the word, -1 for other words
+static inline int64_t time_high(uint32_t word, RawFormat format){
+    if(format == RawFormat::EVT2){
+        return (word >> 28) == 0x8 ? (int64_t)(word & 0x0fffffff) : -1;
+    }
+    return (word >> 12) == 0x8 ? (int64_t)(word & 0xfff) : -1;
+}
+
+
+bool parse_raw_header(const uint8_t *data, size_t size, RawHeader &header){
+    header = RawHeader();
+    size_t pos = 0;
+
+    while(pos < size){
+        if(data[pos] != '%'){
+            header.data_offset = pos;
+            break;
+        }
+        const uint8_t *eol = (const uint8_t*)memchr(data + pos, '\n', size - pos);
+        if(!eol){
+            return false;
+        }
+        std::string line((const char*)data + pos, eol - (data + pos));
+        pos = eol - data + 1;
+
+        if(line.rfind("% format ", 0) == 0 || line.rfind("% evt ", 0) == 0){
+            if(line.find("EVT3") != std::string::npos || line.find("evt 3") != std::string::npos){
+                header.format = RawFormat::EVT3;
+            } else if(line.find("EVT21") == std::string::npos &&
+                      (line.find("EVT2") != std::string::npos || line.find("evt 2.0") != std::string::npos)){
+                header.format = RawFormat::EVT2;
+            }
+        }
+
+        size_t key;
+        if((key = line.find("width=")) != std::string::npos){
+            header.width = atoi(line.c_str() + key + 6);
+        }
+        if((key = line.find("height=")) != std::string::npos){
+            header.height = atoi(line.c_str() + key + 7);
+        }
+        if(line.rfind("% geometry ", 0) == 0){
+            sscanf(line.c_str(), "%% geometry %dx%d", &header.width, &header.height);
+        }
+
+        if(line == "% end"){
+            header.data_offset = pos;
+            break;
+        }
+    }
+    return header.data_offset > 0;
+}
+
+
+std::string raw_index_path(const std::string &raw_path){
+    return raw_path + ".idx";
+}
+
+
+
+RawTimeScanner::RawTimeScanner(RawFormat format, int64_t interval_us) :
+    format(format), interval_us(std::max<int64_t>(interval_us, 1)), last_bucket(-1) {}
+
+size_t RawTimeScanner::scan(const uint8_t *data, size_t size, uint64_t offset, std::vector<TimeMark> &marks){
+    size_t word = word_size(format);
+    int shift = time_shift(format);
+    size_t n = size / word * word;
+
+    for(size_t i = 0; i < n; i += word){
+        int64_t high = time_high(read_word(data + i, format), format);
+        if(high < 0){
+            continue;
+        }
+        int64_t bucket = (high << shift) / interval_us;
+        if(bucket != last_bucket){
+            marks.push_back(TimeMark{offset + i, (uint32_t)high});
+            last_bucket = bucket;
+        }
+    }
+    return n;
+}
+
+
+
+RawIndexBuilder::RawIndexBuilder(RawFormat format, int64_t interval_us) :
+    format(format), interval_us(std::max<int64_t>(interval_us, 1)), base(0), last_t(0), next_t(0), started(false) {}
+
+void RawIndexBuilder::add(const std::vector<TimeMark> &marks, std::vector<RawIndexEntry> &entries){
+    int shift = time_shift(format);
+    int64_t range = time_range(format);
+
+    for(const TimeMark &mark : marks){
+        int64_t t = base + ((int64_t)mark.high << shift);
+        if(started && t < last_t - range / 2){
+            base += range;
+            t += range;
+        }
+        last_t = t;
+
+        if(!started || t >= next_t){
+            entries.push_back(RawIndexEntry{t, mark.offset});
+            next_t = (t / interval_us + 1) * interval_us;
+            started = true;
+        }
+    }
+}
+
+
+
+static void write_index_header(FILE *file, const RawHeader &header, int64_t interval_us){
+    RawIndexHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, RAW_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = RAW_INDEX_VERSION;
+    hdr.format = (uint32_t)header.format;
+    hdr.interval_us = interval_us;
+    hdr.data_offset = header.data_offset;
+    fwrite(&hdr, sizeof(hdr), 1, file);
+}
+
+
+size_t build_raw_index(const std::string &raw_path, int64_t interval_us, int threads){
+    int fd = ::open(raw_path.c_str(), O_RDONLY);
+    if(fd < 0){
+        std::cerr << "Cannot open " << raw_path << ": " << strerror(errno) << std::endl;
+        throw "Opening RAW file";
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = st.st_size;
+
+    void *map = size ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if(map == MAP_FAILED){
+        throw "Failed to map RAW file";
+    }
+    const uint8_t *data = (const uint8_t*)map;
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    RawHeader header;
+    if(!parse_raw_header(data, size, header) || header.format == RawFormat::UNKNOWN){
+        munmap(map, size);
+        throw "Unsupported RAW file, only EVT2 and EVT3 can be indexed";
+    }
+
+    // Each thread scans a word aligned chunk, the marks are unwrapped in file order afterwards
+    size_t word = word_size(header.format);
+    size_t words = (size - header.data_offset) / word;
+    size_t chunks = std::max(1, threads);
+    std::vector<std::vector<TimeMark>> marks(chunks);
+    {
+        ThreadPool pool(chunks - 1);
+        pool.parallel_for(chunks, [&](size_t c) {
+            size_t begin = header.data_offset + words * c / chunks * word;
+            size_t end = header.data_offset + words * (c + 1) / chunks * word;
+            RawTimeScanner scanner(header.format, interval_us);
+            scanner.scan(data + begin, end - begin, begin, marks[c]);
+        });
+    }
+    munmap(map, size);
+
+    RawIndexBuilder builder(header.format, interval_us);
+    std::vector<RawIndexEntry> entries;
+    for(const auto &chunk : marks){
+        builder.add(chunk, entries);
+    }
+
+    std::string path = raw_index_path(raw_path);
+    FILE *file = fopen(path.c_str(), "wb");
+    if(!file){
+        std::cerr << "Cannot create " << path << ": " << strerror(errno) << std::endl;
+        throw "Creating RAW index";
+    }
+    write_index_header(file, header, interval_us);
+    fwrite(entries.data(), sizeof(RawIndexEntry), entries.size(), file);
+    if(fclose(file) != 0){
+        throw "Writing RAW index";
+    }
+    return entries.size();
+}
+
+
+
+void RawIndexer::start(const std::string &path){
+    stop();
+
+    raw_path = path;
+    raw_fd = -1;
+    index = nullptr;
+    header = RawHeader();
+    position = 0;
+    scanner.reset();
+    builder.reset();
+    unsupported = false;
+
+    running = true;
+    thread = std::thread(&RawIndexer::run, this);
+}
+
+void RawIndexer::stop(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wake.notify_all();
+    if(thread.joinable()){
+        thread.join();
+    }
+}
+
+
+void RawIndexer::run(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(running && !unsupported){
+        wake.wait_for(lock, std::chrono::milliseconds(poll_ms));
+
+        lock.unlock();
+        poll();
+        lock.lock();
+    }
+    lock.unlock();
+
+    // The recording has stopped, catch up with the end of the file
+    while(!unsupported && poll()){
+    }
+    close();
+}
+
+
+// Indexes the bytes appended since the last call, true when there were any
+bool RawIndexer::poll(){
+    if(raw_fd < 0){
+        raw_fd = ::open(raw_path.c_str(), O_RDONLY);
+        if(raw_fd < 0){
+            return false;
+        }
+    }
+
+    const size_t chunk = 4 << 20;
+    buffer.resize(chunk);
+
+    if(!index){
+        ssize_t n = pread(raw_fd, buffer.data(), 65536, 0);
+        if(n <= 0 || !parse_raw_header(buffer.data(), n, header)){
+            return false;
+        }
+        if(header.format == RawFormat::UNKNOWN){
+            std::cerr << raw_path << ": unsupported event format, not indexed" << std::endl;
+            unsupported = true;
+            return false;
+        }
+
+        std::string path = raw_index_path(raw_path);
+        index = fopen(path.c_str(), "wb");
+        if(!index){
+            std::cerr << "Cannot create " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        write_index_header(index, header, interval_us);
+        position = header.data_offset;
+        scanner.reset(new RawTimeScanner(header.format, interval_us));
+        builder.reset(new RawIndexBuilder(header.format, interval_us));
+    }
+
+    bool progress = false;
+    ssize_t n;
+    while((n = pread(raw_fd, buffer.data(), chunk, position)) > 0){
+        size_t consumed = scanner->scan(buffer.data(), n, position, marks);
+        position += consumed;
+        builder->add(marks, entries);
+        marks.clear();
+
+        if(consumed == 0){
+            break;
+        }
+        progress = true;
+    }
+
+    if(!entries.empty()){
+        fwrite(entries.data(), sizeof(RawIndexEntry), entries.size(), index);
+        fflush(index);
+        entries.clear();
+    }
+    return progress;
+}
+
+
+void RawIndexer::close(){
+    if(index){
+        fclose(index);
+        index = nullptr;
+    }
+    if(raw_fd >= 0){
+        ::close(raw_fd);
+        raw_fd = -1;
+    }
+}
+
+
+
+RawEventReader::RawEventReader(const std::string &raw_path) : base(nullptr), decoded_bytes(0) {
+    fd = ::open(raw_path.c_str(), O_RDONLY);
+    if(fd < 0){
+        std::cerr << "Cannot open " << raw_path << ": " << strerror(errno) << std::endl;
+        throw "Opening RAW file";
+    }
+    struct stat st;
+    fstat(fd, &st);
+    file_size = st.st_size;
+
+    void *map = file_size ? mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if(map == MAP_FAILED){
+        ::close(fd);
+        throw "Failed to map RAW file";
+    }
+    base = (uint8_t*)map;
+
+    if(!parse_raw_header(base, file_size, hdr) || hdr.format == RawFormat::UNKNOWN){
+        munmap(base, file_size);
+        ::close(fd);
+        throw "Unsupported RAW file, only EVT2 and EVT3 can be read";
+    }
+
+    // Without a matching index every read decodes from the start
+    FILE *file = fopen(raw_index_path(raw_path).c_str(), "rb");
+    if(file){
+        RawIndexHeader ih;
+        if(fread(&ih, sizeof(ih), 1, file) == 1 && memcmp(ih.magic, RAW_INDEX_MAGIC, sizeof(ih.magic)) == 0 &&
+           ih.format == (uint32_t)hdr.format && ih.data_offset == hdr.data_offset){
+            RawIndexEntry entry;
+            while(fread(&entry, sizeof(entry), 1, file) == 1 && entry.offset < file_size){
+                index.push_back(entry);
+            }
+        }
+        fclose(file);
+    }
+}
+
+RawEventReader::~RawEventReader(){
+    munmap(base, file_size);
+    ::close(fd);
+}
+
+
+void RawEventReader::read(int64_t t0, int64_t t1, std::vector<RawEvent> &events) const {
+    RawFormat format = hdr.format;
+    size_t word = word_size(format);
+    int shift = time_shift(format);
+    int64_t range = time_range(format);
+
+    size_t pos = hdr.data_offset;
+    int64_t time_base = 0;
+    int64_t high_t = 0;
+
+    auto entry = std::upper_bound(index.begin(), index.end(), t0, [](int64_t t, const RawIndexEntry &e) {
+        return t < e.t_us;
+    });
+    if(entry != index.begin()){
+        --entry;
+        pos = entry->offset;
+        int64_t high = time_high(read_word(base + pos, format), format);
+        if(high >= 0){
+            time_base = entry->t_us - (high << shift);
+            high_t = entry->t_us;
+        } else {
+            pos = hdr.data_offset;
+        }
+    }
+
+    // EVT3 state, rows and vector bases are only known after their words
+    int64_t low = 0;
+    int y = -1;
+    int base_x = 0;
+    int vect_p = 0;
+
+    auto emit = [&](int x, int ey, int p, int64_t t) {
+        if(t >= t0 && t < t1){
+            events.push_back(RawEvent{(uint16_t)x, (uint16_t)ey, (int16_t)p, t});
+        }
+    };
+
+    size_t start = pos;
+    size_t end = hdr.data_offset + (file_size - hdr.data_offset) / word * word;
+    for(; pos < end; pos += word){
+        uint32_t w = read_word(base + pos, format);
+
+        int64_t high = time_high(w, format);
+        if(high >= 0){
+            int64_t t = time_base + (high << shift);
+            if(t < high_t - range / 2){
+                time_base += range;
+                t += range;
+            }
+            high_t = t;
+            low = 0;
+            // Everything from here on is later than the window
+            if(high_t >= t1){
+                break;
+            }
+            continue;
+        }
+
+        if(format == RawFormat::EVT2){
+            uint32_t type = w >> 28;
+            if(type <= 1){
+                emit((w >> 11) & 0x7ff, w & 0x7ff, type, high_t + ((w >> 22) & 0x3f));
+            }
+            continue;
+        }
+
+        switch(w >> 12){
+            case 0x0: y = w & 0x7ff; break;
+            case 0x2: if(y >= 0) emit(w & 0x7ff, y, (w >> 11) & 1, high_t + low); break;
+            case 0x3: base_x = w & 0x7ff; vect_p = (w >> 11) & 1; break;
+            case 0x4:
+            case 0x5: {
+                int bits = (w >> 12) == 0x4 ? 12 : 8;
+                uint32_t mask = w & ((1u << bits) - 1);
+                if(y >= 0){
+                    while(mask){
+                        int i = __builtin_ctz(mask);
+                        emit(base_x + i, y, vect_p, high_t + low);
+                        mask &= mask - 1;
+                    }
+                }
+                base_x += bits;
+                break;
+            }
+            case 0x6: low = w & 0xfff; break;
+            default: break;
+        }
+    }
+    decoded_bytes = pos - start;
+}
@@ -0,0 +1,233 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "representations.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+
+// Below this many events a batch is not worth waking the pool for
+static const size_t PARALLEL_EVENTS = 4096;
+
+
+RepresentationEngine::RepresentationEngine(int width, int height, const Representation_config &config) :
+    w(width), h(height), config(config), current_bin(0), bin_end(0), next_publish(0), last_t(0), processed(0)
+{
+    bin_us = std::max<int64_t>(1, config.window_us / std::max(1, config.bins));
+    tiles = std::max(1, std::min(config.threads, height));
+    if(tiles > 1){
+        pool.reset(new ThreadPool(tiles - 1));
+    }
+
+    size_t plane = (size_t)w * h;
+    if(config.time_surface){
+        last_ts.assign(2 * plane, 0);
+    }
+    if(config.histogram || config.voxel){
+        bin_counts.assign(std::max(1, config.bins) * 2 * plane, 0);
+        window_counts.assign(2 * plane, 0);
+    }
+}
+
+
+void RepresentationEngine::tile_rows(int tile, int &y0, int &y1) const {
+    y0 = (int64_t)h * tile / tiles;
+    y1 = (int64_t)h * (tile + 1) / tiles;
+}
+
+
+void RepresentationEngine::process(const EventBatch &events){
+    size_t n = events.size();
+    if(n == 0){
+        return;
+    }
+
+    const std::vector<int64_t> &t = events.t;
+    if(bin_end == 0){
+        bin_end = t[0] - t[0] % bin_us + bin_us;
+        next_publish = t[0];
+    }
+
+    // Split the batch where it crosses bin boundaries
+    size_t i = 0;
+    while(i < n){
+        size_t j = std::lower_bound(t.begin() + i, t.end(), bin_end) - t.begin();
+        if(j > i){
+            accumulate(events, i, j);
+        }
+        if(j < n){
+            // A gap longer than the window clears every bin once
+            int64_t steps = (t[j] - bin_end) / bin_us + 1;
+            for(int64_t s = 0; s < std::min<int64_t>(steps, config.bins); s++){
+                advance_bin();
+            }
+            bin_end += steps * bin_us;
+        }
+        i = j;
+    }
+
+    last_t = t[n - 1];
+    processed += n;
+
+    if(last_t >= next_publish){
+        if(output.wanted()){
+            publish();
+        }
+        int64_t period = config.publish_hz > 0 ? 1e6 / config.publish_hz : 0;
+        next_publish += period;
+        if(next_publish <= last_t){
+            next_publish = last_t + period;
+        }
+    }
+}
+
+
+void RepresentationEngine::accumulate(const EventBatch &events, size_t begin, size_t end){
+    const uint16_t *ex = events.x.data();
+    const uint16_t *ey = events.y.data();
+    const uint8_t *ep = events.p.data();
+    const int64_t *et = events.t.data();
+    size_t plane = (size_t)w * h;
+
+    int64_t *ts = last_ts.empty() ? nullptr : last_ts.data();
+    uint16_t *bin = bin_counts.empty() ? nullptr : &bin_counts[current_bin * 2 * plane];
+    uint32_t *window = window_counts.empty() ? nullptr : window_counts.data();
+
+    auto rows = [&](int y0, int y1) {
+        for(size_t k = begin; k < end; k++){
+            int y = ey[k];
+            if(y < y0 || y >= y1 || ex[k] >= w){
+                continue;
+            }
+            size_t idx = (size_t)y * w + ex[k] + ep[k] * plane;
+            if(ts){
+                ts[idx] = et[k];
+            }
+            if(bin && bin[idx] != UINT16_MAX){
+                bin[idx]++;
+                window[idx]++;
+            }
+        }
+    };
+
+    if(!pool || end - begin < PARALLEL_EVENTS){
+        rows(0, h);
+        return;
+    }
+    pool->parallel_for(tiles, [&](size_t tile) {
+        int y0, y1;
+        tile_rows(tile, y0, y1);
+        rows(y0, y1);
+    });
+}
+
+
+// The oldest bin leaves the window and becomes the current one
+void RepresentationEngine::advance_bin(){
+    if(bin_counts.empty()){
+        return;
+    }
+    current_bin = (current_bin + 1) % config.bins;
+
+    size_t plane = (size_t)w * h;
+    uint16_t *bin = &bin_counts[current_bin * 2 * plane];
+    uint32_t *window = window_counts.data();
+
+    auto rows = [&](int y0, int y1) {
+        for(size_t pol = 0; pol < 2; pol++){
+            for(size_t idx = pol * plane + (size_t)y0 * w; idx < pol * plane + (size_t)y1 * w; idx++){
+                window[idx] -= bin[idx];
+                bin[idx] = 0;
+            }
+        }
+    };
+
+    if(!pool){
+        rows(0, h);
+        return;
+    }
+    pool->parallel_for(tiles, [&](size_t tile) {
+        int y0, y1;
+        tile_rows(tile, y0, y1);
+        rows(y0, y1);
+    });
+}
+
+
+void RepresentationEngine::publish(){
+    output.try_publish([this](Representations &out) {
+        out.t_us = last_t;
+        size_t plane = (size_t)w * h;
+        int bins = config.bins;
+
+        if(config.time_surface){
+            out.time_surface.create(h, w, CV_32FC2);
+        }
+        if(config.histogram){
+            out.histogram.create(h, w, CV_32SC2);
+        }
+        if(config.voxel){
+            out.voxel.create(h, w, CV_16SC(bins));
+        }
+
+        float decay = -1.0f / std::max(1, config.tau_us);
+
+        auto rows = [&](int y0, int y1) {
+            for(int y = y0; y < y1; y++){
+                size_t row = (size_t)y * w;
+
+                if(config.time_surface){
+                    float *dst = out.time_surface.ptr<float>(y);
+                    for(int x = 0; x < w; x++){
+                        for(size_t pol = 0; pol < 2; pol++){
+                            int64_t ts = last_ts[pol * plane + row + x];
+                            dst[2 * x + pol] = ts ? std::exp((last_t - ts) * decay) : 0.0f;
+                        }
+                    }
+                }
+
+                if(config.histogram){
+                    int32_t *dst = out.histogram.ptr<int32_t>(y);
+                    for(int x = 0; x < w; x++){
+                        dst[2 * x] = window_counts[row + x];
+                        dst[2 * x + 1] = window_counts[plane + row + x];
+                    }
+                }
+
+                if(config.voxel){
+                    int16_t *dst = out.voxel.ptr<int16_t>(y);
+                    for(int b = 0; b < bins; b++){
+                        const uint16_t *bin = &bin_counts[((current_bin + 1 + b) % bins) * 2 * plane];
+                        for(int x = 0; x < w; x++){
+                            int v = (int)bin[plane + row + x] - bin[row + x];
+                            dst[x * bins + b] = std::max(-32768, std::min(32767, v));
+                        }
+                    }
+                }
+            }
+        };
+
+        if(!pool){
+            rows(0, h);
+            return;
+        }
+        pool->parallel_for(tiles, [&](size_t tile) {
+            int y0, y1;
+            tile_rows(tile, y0, y1);
+            rows(y0, y1);
+        });
+    });
+}
@@ -0,0 +1,62 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "session_barrier.hpp"
+
+
+void SessionBarrier::reset(size_t devices){
+    std::lock_guard<std::mutex> lock(mutex);
+    state = State::ARMING;
+    expected = devices;
+    arrived = 0;
+}
+
+
+bool SessionBarrier::arrive_and_wait(){
+    std::unique_lock<std::mutex> lock(mutex);
+    if(state != State::ARMING){
+        return state == State::COMMITTED;
+    }
+    arrived++;
+    condition.notify_all();
+    condition.wait(lock, [this]() { return state != State::ARMING; });
+    return state == State::COMMITTED;
+}
+
+
+bool SessionBarrier::wait_armed(std::chrono::milliseconds timeout){
+    std::unique_lock<std::mutex> lock(mutex);
+    return condition.wait_for(lock, timeout, [this]() { return arrived >= expected; });
+}
+
+
+void SessionBarrier::commit(){
+    std::lock_guard<std::mutex> lock(mutex);
+    state = State::COMMITTED;
+    condition.notify_all();
+}
+
+
+void SessionBarrier::abort(){
+    std::lock_guard<std::mutex> lock(mutex);
+    state = State::ABORTED;
+    condition.notify_all();
+}
+
+
+size_t SessionBarrier::armed(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return arrived;
+}
@@ -0,0 +1,85 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "session_stager.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+
+SessionStager::SessionStager(const std::string &output_dir, std::vector<Device*> &devices) :
+    output_dir(output_dir), staged_path(fs::path(output_dir) / ".staged"), devices(devices) {}
+
+// The preallocated outputs would otherwise stay on disk
+SessionStager::~SessionStager(){
+    if(worker.joinable()){
+        worker.join();
+    }
+    boost::system::error_code ec;
+    fs::remove_all(staged_path, ec);
+}
+
+
+void SessionStager::stage(){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(worker.joinable()){
+        worker.join();
+    }
+    worker = std::thread(&SessionStager::prepare, this);
+}
+
+
+void SessionStager::prepare(){
+    auto begin = std::chrono::steady_clock::now();
+    try {
+        // Left over from a session that was never started, its preallocation may not match anymore
+        fs::remove_all(staged_path);
+        fs::create_directories(staged_path);
+        for(Device *device : devices){
+            device->stage(staged_path);
+        }
+    } catch(const char* err) {
+        std::cerr << "Staging the next session: " << err << std::endl;
+        return;
+    } catch(const fs::filesystem_error &e) {
+        std::cerr << "Staging the next session: " << e.what() << std::endl;
+        return;
+    }
+    staged = true;
+    printf("Next session staged in %.0f ms\n",
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+}
+
+
+fs::path SessionStager::take(const std::string &name){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(worker.joinable()){
+        worker.join();
+    }
+
+    fs::path path = output_dir / name;
+    if(staged){
+        staged = false;
+        boost::system::error_code ec;
+        fs::rename(staged_path, path, ec);
+        if(!ec){
+            return path;
+        }
+        std::cerr << "Cannot rename the staged session: " << ec.message() << std::endl;
+    }
+    fs::create_directories(path);
+    return path;
+}
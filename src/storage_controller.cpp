@@ -0,0 +1,248 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "storage_controller.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+#include <sys/statvfs.h>
+
+
+DegradeStep degrade_step_from_string(const std::string &name){
+    if(name == "preview"){
+        return DegradeStep::PREVIEW;
+    } else if(name == "decimate"){
+        return DegradeStep::DECIMATE;
+    } else if(name == "erc"){
+        return DegradeStep::ERC;
+    } else if(name == "stop"){
+        return DegradeStep::STOP;
+    }
+
+    std::cerr << "Unknown degradation step: " << name << std::endl;
+    throw "Unknown degradation step";
+}
+
+const char* degrade_step_name(DegradeStep step){
+    switch(step){
+        case DegradeStep::PREVIEW:  return "preview";
+        case DegradeStep::DECIMATE: return "decimate";
+        case DegradeStep::ERC:      return "erc";
+        case DegradeStep::STOP:     return "stop";
+    }
+    return "unknown";
+}
+
+
+static double now_s(){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+
+void StorageController::start(){
+    if(!config.enabled || thread.joinable()){
+        return;
+    }
+    thread = std::thread(&StorageController::run, this);
+}
+
+void StorageController::stop(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    condition.notify_all();
+    if(thread.joinable()){
+        thread.join();
+    }
+}
+
+
+void StorageController::start_session(const fs::path &path){
+    if(!config.enabled){
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for(Device *device : devices){
+        device->reset_throttling();
+    }
+
+    session_path = path;
+    log.open((path / "storage.log").string());
+    session_start = now_s();
+    last_sample = session_start;
+    last_step = 0;
+    next_step = 0;
+    pressure_samples = 0;
+    last_bytes.assign(devices.size(), 0);
+    active = true;
+
+    write_log("session started, steps:" + [this]() {
+        std::string s;
+        for(DegradeStep step : config.steps){
+            s += std::string(" ") + degrade_step_name(step);
+        }
+        return s;
+    }());
+}
+
+void StorageController::end_session(){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!active){
+        return;
+    }
+    write_log("session ended");
+    log.close();
+    active = false;
+
+    for(Device *device : devices){
+        device->reset_throttling();
+    }
+}
+
+
+void StorageController::run(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!stopped){
+        condition.wait_for(lock, std::chrono::milliseconds(config.interval_ms));
+        if(stopped){
+            break;
+        }
+        if(!active){
+            continue;
+        }
+
+        sample();
+
+        // The stop callback ends the session through end_session(), which takes the mutex
+        if(stop_requested){
+            stop_requested = false;
+            lock.unlock();
+            stop_session();
+            lock.lock();
+        }
+    }
+}
+
+
+// With the mutex held
+void StorageController::sample(){
+    double t = now_s();
+    double dt = t - last_sample;
+    last_sample = t;
+
+    bool behind = false;
+    double mb_s = 0;
+    char line[512];
+    std::string status;
+
+    for(size_t i = 0; i < devices.size(); i++){
+        StorageStatus s = devices[i]->storage_status();
+        double rate = dt > 0 && s.bytes_written >= last_bytes[i] ? (s.bytes_written - last_bytes[i]) / dt / 1e6 : 0;
+        last_bytes[i] = s.bytes_written;
+        mb_s += rate;
+
+        if(s.queue_capacity > 0 && s.queue_depth >= config.queue_high * s.queue_capacity){
+            behind = true;
+        }
+        snprintf(line, sizeof(line), " %s %zu/%zu %.1f MB/s", devices[i]->name(), s.queue_depth, s.queue_capacity, rate);
+        status += line;
+    }
+
+    struct statvfs vfs;
+    double free_gb = -1;
+    if(statvfs(session_path.c_str(), &vfs) == 0){
+        free_gb = (double)vfs.f_bavail * vfs.f_frsize / 1e9;
+    }
+    double remaining_s = mb_s > 0 && free_gb >= 0 ? free_gb * 1e3 / mb_s : -1;
+
+    snprintf(line, sizeof(line), " | %.1f MB/s, free %.2f GB, %.0f s left", mb_s, free_gb, remaining_s);
+    write_log("sample" + status + line);
+
+    // Running out of space skips the remaining steps
+    if(free_gb >= 0 && free_gb < config.min_free_gb){
+        snprintf(line, sizeof(line), "free space %.2f GB below %.2f GB", free_gb, config.min_free_gb);
+        apply(DegradeStep::STOP, line);
+        return;
+    }
+
+    bool short_on_space = remaining_s >= 0 && remaining_s < config.min_remaining_s;
+    pressure_samples = behind || short_on_space ? pressure_samples + 1 : 0;
+
+    if(pressure_samples < config.sustain || next_step >= config.steps.size()){
+        return;
+    }
+    if(last_step > 0 && t - last_step < config.hold_s){
+        return;
+    }
+
+    if(behind){
+        snprintf(line, sizeof(line), "writer queue above %.0f%% for %d samples", config.queue_high * 100, pressure_samples);
+    } else {
+        snprintf(line, sizeof(line), "%.0f s of free space left at %.1f MB/s", remaining_s, mb_s);
+    }
+
+    // Steps that apply to none of the devices are skipped
+    while(next_step < config.steps.size()){
+        DegradeStep step = config.steps[next_step++];
+        if(apply(step, line)){
+            last_step = t;
+            break;
+        }
+    }
+}
+
+
+// With the mutex held
+bool StorageController::apply(DegradeStep step, const std::string &reason){
+    bool applied = false;
+    std::string who;
+
+    for(Device *device : devices){
+        bool ok = false;
+        switch(step){
+            case DegradeStep::PREVIEW:  ok = device->throttle_preview(config.preview_interval); break;
+            case DegradeStep::DECIMATE: ok = device->decimate(config.ximea_decimation); break;
+            case DegradeStep::ERC:      ok = device->scale_erc(config.erc_factor); break;
+            case DegradeStep::STOP:     ok = true; break;
+        }
+        if(ok && step != DegradeStep::STOP){
+            who += std::string(" ") + device->name();
+        }
+        applied |= ok;
+    }
+
+    std::string message = std::string("ACTION ") + degrade_step_name(step) + (applied ? "" : " (no device)") + who + ": " + reason;
+    write_log(message);
+    std::cout << "\nStorage: " << message << std::endl;
+
+    if(applied){
+        pressure_samples = 0;
+        stop_requested |= step == DegradeStep::STOP;
+    }
+    return applied;
+}
+
+
+void StorageController::write_log(const std::string &line){
+    char stamp[32];
+    snprintf(stamp, sizeof(stamp), "%9.1f ", now_s() - session_start);
+    log << stamp << line << "\n";
+    log.flush();
+}
@@ -0,0 +1,134 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "thread_placement.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef PROPHEXI_HAVE_NUMA
+#include <numa.h>
+#endif
+
+
+void set_placement_config(ThreadPlacement_config &config, const YAML::Node &node){
+    if(node["cpus"]){
+        config.cpus = node["cpus"].as<std::vector<int>>();
+    }
+    if(node["priority"]){
+        config.priority = node["priority"].as<int>();
+    }
+    if(node["numa_local"]){
+        config.numa_local = node["numa_local"].as<bool>();
+    }
+}
+
+
+static std::string cpu_list(const cpu_set_t &set){
+    std::string s;
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+        if(CPU_ISSET(cpu, &set)){
+            s += (s.empty() ? "" : ",") + std::to_string(cpu);
+        }
+    }
+    return s;
+}
+
+
+ScopedPlacement::ScopedPlacement(const ThreadPlacement_config &config, const std::string &who, bool report_placement){
+    if(config.empty()){
+        return;
+    }
+    std::string report;
+    pthread_t self = pthread_self();
+
+    if(!config.cpus.empty()){
+        cpu_set_t wanted;
+        CPU_ZERO(&wanted);
+        for(int cpu : config.cpus){
+            if(cpu >= 0 && cpu < CPU_SETSIZE){
+                CPU_SET(cpu, &wanted);
+            }
+        }
+
+        pthread_getaffinity_np(self, sizeof(old_cpus), &old_cpus);
+        int err = pthread_setaffinity_np(self, sizeof(wanted), &wanted);
+        if(err == 0){
+            // The kernel drops CPUs outside the cpuset, report what is in effect
+            cpu_set_t applied;
+            pthread_getaffinity_np(self, sizeof(applied), &applied);
+            report += " cpus " + cpu_list(applied) + " applied;";
+            affinity_set = true;
+        } else {
+            report += " cpus " + cpu_list(wanted) + " refused (" + strerror(err) + ");";
+        }
+    }
+
+    if(config.priority > 0){
+        pthread_getschedparam(self, &old_policy, &old_param);
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config.priority;
+        int err = pthread_setschedparam(self, SCHED_FIFO, &param);
+        if(err == 0){
+            report += " SCHED_FIFO " + std::to_string(config.priority) + " applied;";
+            sched_set = true;
+        } else {
+            // EPERM without CAP_SYS_NICE or an rtprio limit
+            report += " SCHED_FIFO " + std::to_string(config.priority) + " refused (" + strerror(err) + ");";
+        }
+    }
+
+    if(config.numa_local && !config.cpus.empty()){
+#ifdef PROPHEXI_HAVE_NUMA
+        if(numa_available() < 0){
+            report += " NUMA not available;";
+        } else {
+            int node = numa_node_of_cpu(config.cpus[0]);
+            if(node < 0){
+                report += " NUMA node of cpu " + std::to_string(config.cpus[0]) + " unknown;";
+            } else {
+                numa_set_preferred(node);
+                mempolicy_set = true;
+                report += " buffers on node " + std::to_string(node) + " of " + std::to_string(numa_max_node() + 1) + ";";
+            }
+        }
+#else
+        report += " NUMA placement needs libnuma, buffers follow first touch;";
+#endif
+    }
+
+    report.pop_back();
+    if(report_placement){
+        printf("Placement %s:%s\n", who.c_str(), report.c_str());
+    }
+}
+
+
+ScopedPlacement::~ScopedPlacement(){
+    pthread_t self = pthread_self();
+    if(affinity_set){
+        pthread_setaffinity_np(self, sizeof(old_cpus), &old_cpus);
+    }
+    if(sched_set){
+        pthread_setschedparam(self, old_policy, &old_param);
+    }
+#ifdef PROPHEXI_HAVE_NUMA
+    if(mempolicy_set){
+        numa_set_localalloc();
+    }
+#endif
+}
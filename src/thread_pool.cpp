@@ -0,0 +1,115 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+
+ThreadPool::ThreadPool(int n_threads) : stopped(false) {
+    for(int i = 0; i < n_threads; i++){
+        threads.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    work.notify_all();
+
+    for(auto &t : threads){
+        t.join();
+    }
+}
+
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t)> &fn){
+    if(n == 0){
+        return;
+    }
+
+    Batch batch;
+    batch.fn = &fn;
+    batch.n = n;
+    batch.next = 0;
+    batch.done = 0;
+    batch.users = 0;
+    batch.failed = false;
+
+    if(n > 1 && !threads.empty()){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batches.push_back(&batch);
+        }
+        work.notify_all();
+    }
+
+    run_batch(batch);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = std::find(batches.begin(), batches.end(), &batch);
+    if(it != batches.end()){
+        batches.erase(it);
+    }
+    finished.wait(lock, [&batch]() { return batch.done == batch.n && batch.users == 0; });
+
+    if(batch.error){
+        std::rethrow_exception(batch.error);
+    }
+}
+
+
+void ThreadPool::run_batch(Batch &batch){
+    size_t i;
+    while((i = batch.next++) < batch.n){
+        // Anything escaping here would terminate a worker or leave the batch running after the caller unwound
+        try {
+            (*batch.fn)(i);
+        } catch(...) {
+            if(!batch.failed.exchange(true)){
+                batch.error = std::current_exception();
+            }
+        }
+        batch.done++;
+    }
+}
+
+
+void ThreadPool::run(){
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(true){
+        work.wait(lock, [this]() { return stopped || !batches.empty(); });
+        if(stopped){
+            return;
+        }
+
+        Batch *batch = batches.front();
+        if(batch->next >= batch->n){
+            batches.pop_front();
+            continue;
+        }
+
+        batch->users++;
+        lock.unlock();
+
+        run_batch(*batch);
+
+        lock.lock();
+        batch->users--;
+        finished.notify_all();
+    }
+}
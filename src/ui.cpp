@@ -14,6 +14,10 @@
 
 #include "ui.hpp"
 
+#include <cctype>
+#include <string>
+#include <vector>
+
 
 #include <opencv2/core.hpp> 
 #include <opencv2/highgui/highgui.hpp>
@@ -25,48 +29,46 @@
 #include <opencv2/imgproc.hpp>
 
 
+// Window titles are the capitalised device names
+static std::string window_name(const Device *camera){
+    std::string name = camera->name();
+    if(!name.empty()){
+        name[0] = toupper(name[0]);
+    }
+    return name;
+}
+
+
 void UI::run(){
 
+    std::vector<std::string> windows;
+    for(Device *camera : cameras){
+        windows.push_back(window_name(camera));
+        cv::namedWindow(windows.back(), CV_WINDOW_NORMAL);
+        camera->attach_viewer();
+    }
 
-    cv::namedWindow("Ximea", CV_WINDOW_NORMAL);
-    cv::namedWindow("Right", CV_WINDOW_NORMAL);
-    cv::namedWindow("Left", CV_WINDOW_NORMAL);
 
+    // Ximea publishes an already debayered BGR8 preview, the event cameras their CD frames
+    std::vector<cv::Mat> out_frames(cameras.size());
 
     while(true){
         std::unique_lock<std::mutex> lock(mutex);
 		if(stopped){
+            for(Device *camera : cameras){
+                camera->detach_viewer();
+            }
             cv::destroyAllWindows();
 			break;
 		}
         lock.unlock();
 
 
-        cv::Mat out_frame_right;
-        cv::Mat out_frame_left;
-        cv::Mat out_frame_ximea;
-
-        out_frame_ximea = cameras[0]->get_output_frame();
-        out_frame_left = cameras[1]->get_output_frame();
-        out_frame_right = cameras[2]->get_output_frame();
-
-
-        if(!out_frame_left.empty()){
-            cv::imshow("Left", out_frame_left);
-        }  
-        
-        if(!out_frame_right.empty()){
-            cv::imshow("Right", out_frame_right);
-        }        
-        
-        if(!out_frame_ximea.empty()){
-
-            cv::cvtColor(out_frame_ximea, out_frame_ximea, cv::COLOR_BayerGBRG2BGR);
-            
-            cv::Mat out_rgb;
-
-            out_frame_ximea.convertTo(out_rgb, CV_8UC3, 1/256.0);
-            cv::imshow("Ximea", out_rgb);
+        // Windows are only redrawn when their device published something new
+        for(size_t i = 0; i < cameras.size(); i++){
+            if(cameras[i]->get_output_frame(out_frames[i])){
+                cv::imshow(windows[i], out_frames[i]);
+            }
         }
         
         cv::waitKey(33);
@@ -14,6 +14,12 @@
 
 #include "ximea.hpp"
 #include "device.hpp"
+#include "frame_ring.hpp"
+#include "frame_writer.hpp"
+#include "frame_sink.hpp"
+#include "bit_align.hpp"
+#include "frame_log.hpp"
+#include "preview.hpp"
 
 
 
@@ -27,71 +33,136 @@
 #include <opencv2/imgproc.hpp>
 
 #include <m3api/xiApi.h> // Linux, OSX
-#include <tiffio.h>
 
 #define CE(func) {XI_RETURN stat = (func); if (XI_OK!=stat) {printf("Error:%d returned from function:"#func"\n",stat);throw "Error";}}
 
 #include <boost/filesystem.hpp>
 
-#include <fstream>
+#include <atomic>
+#include <chrono>
 
-namespace fs = boost::filesystem;
-
-
-void WriteImage(cv::Mat& image, const char* filename)
-{
-	TIFF* tiff_img = TIFFOpen(filename, "w");
-	if (!tiff_img)
-		throw "Opening image by TIFFOpen";
+#include <sys/stat.h>
 
-	// set tiff tags
-	int width = image.cols;
-	int height = image.rows; 
+namespace fs = boost::filesystem;
 
 
-	int bits_per_sample = 8;
-    if(image.type() == CV_16U || image.type() == CV_16UC1 || image.type () == CV_16UC3){
-        bits_per_sample = 16;
+void set_ximea_config(Ximea_config &config, const YAML::Node &node){
+    if (node["serial"])
+        config.serial = node["serial"].as<std::string>();
+    if (node["fps"])
+        config.fps = node["fps"].as<int>();
+    if (node["ae_max_lim"])
+        config.ae_max_lim = node["ae_max_lim"].as<int>();
+    if (node["ag_max_lim"])
+        config.ag_max_lim = node["ag_max_lim"].as<float>();
+    if (node["aeag_level"])
+        config.aeag_level = node["aeag_level"].as<int>();
+    if (node["exp_priority"])
+        config.exp_priority = node["exp_priority"].as<float>();
+    if (node["ae_manual"])
+        config.ae_enabled = !node["ae_manual"].as<bool>();
+    if (node["writer_threads"])
+        config.writer_threads = node["writer_threads"].as<int>();
+    if (node["ring_slots"])
+        config.ring_slots = node["ring_slots"].as<int>();
+    if (node["ring_policy"])
+        config.ring_policy = ring_policy_from_string(node["ring_policy"].as<std::string>());
+    if (node["sink"])
+        config.sink = sink_type_from_string(node["sink"].as<std::string>());
+    if (node["msb_align"])
+        config.msb_align = node["msb_align"].as<bool>();
+    if (node["packed10"])
+        config.packed10 = node["packed10"].as<bool>();
+    if (node["compression"])
+        config.compression.codec = codec_from_string(node["compression"].as<std::string>());
+    if (node["compression_level"])
+        config.compression.level = node["compression_level"].as<int>();
+    if (node["rows_per_strip"])
+        config.compression.rows_per_strip = node["rows_per_strip"].as<int>();
+    if (node["predictor"])
+        config.compression.predictor = node["predictor"].as<bool>();
+    if (node["compress_threads"])
+        config.compression.threads = node["compress_threads"].as<int>();
+    if (node["buffer_policy"])
+        config.unsafe_buffers = node["buffer_policy"].as<std::string>() == "unsafe";
+    if (node["acq_buffer_size_mb"])
+        config.acq_buffer_size_mb = node["acq_buffer_size_mb"].as<int>();
+    if (node["buffers_queue_size"])
+        config.buffers_queue_size = node["buffers_queue_size"].as<int>();
+    if (node["io_backend"])
+        config.io_backend = io_backend_from_string(node["io_backend"].as<std::string>());
+    if (node["io_block_mb"])
+        config.io_block_mb = node["io_block_mb"].as<int>();
+    if (node["io_queue_depth"])
+        config.io_queue_depth = node["io_queue_depth"].as<int>();
+    if (node["expected_duration_s"])
+        config.expected_duration_s = node["expected_duration_s"].as<int>();
+    if (node["telemetry_interval_ms"])
+        config.telemetry_interval_ms = node["telemetry_interval_ms"].as<int>();
+    if (node["preview_downscale"])
+        config.preview_downscale = node["preview_downscale"].as<int>();
+
+    // preview_gbrg() would refuse it on every frame, after the frame was written
+    if (config.preview_downscale < 1) {
+        std::cerr << "Ximea: preview_downscale must be at least 1, got " << config.preview_downscale << std::endl;
+        throw "Invalid preview_downscale";
     }
 
-    int line_len = 0;
-	line_len = width * (bits_per_sample / 8);
-	// printf("Saving image %dx%d to file:%s\n", width, height, filename);
-
-	TIFFSetField(tiff_img, TIFFTAG_IMAGEWIDTH, width);
-	TIFFSetField(tiff_img, TIFFTAG_IMAGELENGTH, height);
-	TIFFSetField(tiff_img, TIFFTAG_ROWSPERSTRIP, height);
-	
-    TIFFSetField(tiff_img, TIFFTAG_BITSPERSAMPLE, bits_per_sample);
-	TIFFSetField(tiff_img, TIFFTAG_MINSAMPLEVALUE, 0);
-	TIFFSetField(tiff_img, TIFFTAG_MAXSAMPLEVALUE, (1 << bits_per_sample) - 1);
-
-	TIFFSetField(tiff_img, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
-	TIFFSetField(tiff_img, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-
-	if (image.type() == CV_16UC3 || image.type() == CV_8UC3){
-        TIFFSetField(tiff_img, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
-	    TIFFSetField(tiff_img, TIFFTAG_SAMPLESPERPIXEL, 3);
-    } else {
-        TIFFSetField(tiff_img, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
-	    TIFFSetField(tiff_img, TIFFTAG_SAMPLESPERPIXEL, 1);
+    // TiffFrameSink would only refuse it once the first recording starts
+    if (config.sink == SinkType::TIFF && config.compression.codec == Codec::LZ4) {
+        std::cerr << "Ximea: compression lz4 needs sink: container" << std::endl;
+        throw "Invalid compression";
     }
-	//TIFFSetField(tiff_img, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
-	//TIFFSetField(tiff_img, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_INT);
+}
 
-	// save data
-	if (TIFFWriteEncodedStrip(tiff_img, 0, image.data, line_len*height) == -1)
-	{
-		throw("ImageFailed to write image");
-	}
 
-	TIFFWriteDirectory(tiff_img);
-	TIFFClose(tiff_img);
+// Uncompressed frames are the upper bound, the file is trimmed to what was written when it is closed
+uint64_t Ximea::container_preallocation() const {
+	uint64_t frames = (uint64_t)config.fps * config.expected_duration_s;
+	uint64_t frame_bytes = (uint64_t)width * height * 2 + CONTAINER_CHUNK_ALIGN + sizeof(ContainerRecord);
+	return frames ? CONTAINER_HEADER_SIZE + frames * frame_bytes + sizeof(ContainerFooter) : 0;
 }
 
 
+// Packed frames carry the plain 10 bit values, readers restore the alignment
+SinkFormat Ximea::sink_format() const {
+	SinkFormat format;
+	format.significant_bits = XIMEA_SIGNIFICANT_BITS;
+	format.bit_shift = config.msb_align && !config.packed10 ? XIMEA_MSB_SHIFT : 0;
+	format.packed10 = config.packed10;
+	format.compression = config.compression;
+
+	format.io.backend = config.io_backend;
+	format.io.block_bytes = (size_t)config.io_block_mb << 20;
+	format.io.queue_depth = config.io_queue_depth;
+	format.io.preallocate = container_preallocation();
+	return format;
+}
 
 
+// Off the hot path: the container is preallocated and opened here, with its staging blocks, I/O
+// and compression threads. prepare_recording() then only hands it over. TIFF sinks write by path
+// and are only built there.
+void Ximea::stage_recording(fs::path path){
+	if(config.sink == SinkType::CONTAINER){
+		fs::path file = path / fs::path(config.output_name + ".pxf");
+		uint64_t bytes = container_preallocation();
+		if(bytes){
+			preallocate_file(file.string(), bytes);
+		}
+
+		staged_sink.reset();
+		std::unique_ptr<FrameSink> staged(new ContainerFrameSink(file, width, height, CV_16UC1, sink_format()));
+		struct stat st;
+		if(stat(file.c_str(), &st) == 0){
+			staged_dev = st.st_dev;
+			staged_ino = st.st_ino;
+			staged_sink = std::move(staged);
+		}
+	} else {
+		fs::create_directories(path / fs::path(config.output_name));
+	}
+}
 
 
 void Ximea::prepare_recording(fs::path path){
@@ -103,58 +174,141 @@ void Ximea::prepare_recording(fs::path path){
 	destination_path = path;
 
 
-	fs::path ximea ("ximea");
-	fs::path ts_file ("ximea_ts.csv");
+	const std::string &name = config.output_name;
 
-	frames_path = path / ximea;
+	frames_path = path / fs::path(name);
 
-	timestamps_file = path / ts_file;
+	timestamps_file = path / fs::path(name + "_ts.bin");
+	telemetry_file = path / fs::path(name + "_telemetry.csv");
 
 
-    fs::create_directories(frames_path);
+	if(config.sink == SinkType::CONTAINER){
+		// The staged container unless the session directory was not the staged one
+		fs::path file = path / fs::path(name + ".pxf");
+		struct stat st;
+		if(staged_sink && stat(file.c_str(), &st) == 0 && st.st_dev == staged_dev && st.st_ino == staged_ino){
+			pending_sink = std::move(staged_sink);
+		} else {
+			staged_sink.reset();
+			pending_sink.reset(new ContainerFrameSink(file, width, height, CV_16UC1, sink_format()));
+		}
+		printf("Ximea: writing %s.pxf with %s I/O\n", name.c_str(), io_backend_name(((ContainerFrameSink*)pending_sink.get())->backend()));
+	} else {
+		pending_sink.reset(new TiffFrameSink(frames_path, sink_format()));
+	}
 }
 
 
-void Ximea::run(){
-	long long last_ts = 0;
+StorageStatus Ximea::storage_status(){
+	StorageStatus s;
+	s.queue_depth = queue_depth;
+	s.queue_capacity = queue_capacity;
+	s.bytes_written = session_bytes;
+	return s;
+}
 
+bool Ximea::decimate(int factor){
+	save_decimation = factor > 1 ? factor : 1;
+	return true;
+}
+
+void Ximea::reset_throttling(){
+	Device::reset_throttling();
+	save_decimation = 1;
+}
+
+
+void Ximea::run(){
 	
 	int img_size_bytes = 0;
 	CE(xiGetParamInt(xiH, XI_PRM_IMAGE_PAYLOAD_SIZE, &img_size_bytes));
 	// unsigned char * img_buffer = (unsigned char*)malloc(img_size_bytes);
 
-	int width, height;
-	xiGetParamInt(xiH, XI_PRM_WIDTH, &width);
-	xiGetParamInt(xiH, XI_PRM_HEIGHT, &height);
-
 
+	// Frames dropped by the ring policy are still read from the camera, into this scratch buffer
 	cv::Mat cv_mat_image = cv::Mat(height,width,CV_16UC1);
-	cv::Mat rgb_image = cv::Mat(height, width, CV_16UC3);
+
+	// With XI_BP_UNSAFE the driver cycles through its queue of buffers. A lent buffer has to be back
+	// before the driver could hand it out again, two buffers stay reserved for the frames in transfer.
+	bool zero_copy = config.unsafe_buffers;
+	uint64_t lease_depth = buffers_queue_size > 2 ? buffers_queue_size - 2 : 1;
+
+	// Full frame memcpys done by us or the driver, reported per frame
+	std::atomic<uint64_t> frame_copies(0);
+
+	FrameRing ring(config.ring_slots, height, width, CV_16UC1, config.ring_policy);
+	FrameWriter writer(ring, config.writer_threads);
+	telemetry.reset(new XimeaTelemetry(xiH, config.telemetry_interval_ms));
+
+	// Scraped from the metrics endpoint, see metrics.hpp
+	std::string labels = metric_labels();
+	Counter &frames_metric = metrics->counter("prophexi_frames_total", "Frames received from the camera", labels);
+	Gauge &fps_metric = metrics->gauge("prophexi_frames_per_second", "Frame rate from the camera timestamps", labels);
+	Counter &skipped_metric = metrics->counter("prophexi_skipped_frames_total", "Gaps in the acquisition frame numbers", labels);
+	Histogram &write_metric = metrics->histogram("prophexi_write_seconds", "Time the sink takes to write one frame", labels);
+
+	// Runs on the writer threads
+	auto write_frame = [this, &write_metric](FrameSlot &slot) {
+		uint16_t *pixels = (uint16_t*)slot.image.data;
+		size_t n_pixels = slot.image.total();
+
+		// We record 10bit in 16bit integer. Shift to make MSB also MSB in the two bytes.
+		bool aligned = config.msb_align && !config.packed10;
+		if(aligned){
+			shift_left_u16(pixels, pixels, n_pixels, XIMEA_MSB_SHIFT);
+		}
+
+		auto write_start = std::chrono::steady_clock::now();
+		sink->write(slot);
+		write_metric.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start).count());
+
+		// Debayered BGR8 preview, create() only allocates the first time each mailbox buffer is used
+		if(preview.wanted() && slot.meta.frame_id % preview_interval == 0){
+			int downscale = config.preview_downscale;
+			preview.try_publish([&slot, pixels, aligned, downscale](cv::Mat &frame) {
+				frame.create(preview_size(slot.image.rows, downscale), preview_size(slot.image.cols, downscale), CV_8UC3);
+				preview_gbrg(pixels, slot.image.step, slot.image.cols, slot.image.rows, frame.data, frame.step,
+					downscale, aligned ? 8 : XIMEA_SIGNIFICANT_BITS - 8);
+			});
+		}
+	};
 	
 
-	std::cout << "Ximea ready" << std::endl;
+	std::cout << "Ximea ready (shift kernel: " << best_shift_kernel().name << ", preview kernel: " << best_preview_kernel().name << ", buffers: "
+			  << (zero_copy ? "unsafe" : "safe") << ", queue " << buffers_queue_size << ")" << std::endl;
+	mark_ready();
 	while(true){
 
 
 		// Wait here for recording to resume
 		std::unique_lock<std::mutex> lock(mutex);
-		condition.wait(lock);
+		condition.wait(lock, [this]() { return !paused || stopped; });
 		if(stopped){
 			break;
 		}
+		// The writers only ever see this session's sink, arm() waits for mark_drained() before it builds the next
+		sink = std::move(pending_sink);
 		lock.unlock();
 
-		std::ofstream ts_file(timestamps_file.string());
-		ts_file << "frame_id," 
-				<< "ts, " 
-				<< "exposure, " 
-				<< "gain, " 
-				<< "skip_frames"				
-				<< std::endl;
+		// Converted to <name>_ts.csv by prophexi_export
+		FrameLogWriter ts_log(timestamps_file.string());
 
+		writer.start(write_frame);
+		telemetry->start(telemetry_file.string());
+
+		// Everything is open, acquisition starts when all devices are armed
+		if(!wait_for_commit()){
+			telemetry->stop();
+			writer.stop();
+			sink->close();
+			sink.reset();
+			mark_drained();
+			continue;
+		}
 
 		try{
 			xiStartAcquisition(xiH);
+			mark_capture_start();
 		} catch(const char* err ) {
 			std::cerr << err << std::endl;
 			throw err;
@@ -163,23 +317,49 @@ void Ximea::run(){
 		long long last_ts = 0;
 
 		int frame_id = 0;
+		uint64_t n_get = 0;
+		uint64_t decimated = 0;
+		frame_copies = 0;
+		session_bytes = 0;
+		queue_capacity = ring.capacity();
+
+		// Gaps in the acquisition frame number, counted from the image header without asking the driver
+		DWORD last_acq_nframe = 0;
+		int number_of_skipped_frames = 0;
 
 		while(true){
 			
+			// Frames decimated by the StorageController are read into the scratch buffer and only logged
+			bool keep = frame_id % save_decimation == 0;
+			FrameSlot *slot = keep ? ring.acquire() : nullptr;
+			decimated += !keep;
+			cv::Mat &target = slot ? slot->image : cv_mat_image;
+
 			XI_IMG image; // image buffer
 			memset(&image, 0, sizeof(image));
 			image.size = sizeof(XI_IMG);
 
-			image.bp = cv_mat_image.data;
-            image.bp_size = img_size_bytes;
+			n_get++;
+			if(zero_copy){
+				if(n_get > lease_depth){
+					ring.wait_leases(n_get - lease_depth + 1);
+				}
+			} else {
+				image.bp = target.data;
+				image.bp_size = img_size_bytes;
+			}
 
 			CE(xiGetImage(xiH, 5000, &image)); // getting next image from the camera opened
 
-
-
-			// We record 10bit in 16bit integer. Shift to make MSB also MSB in the two bytes.
-            cv::Mat shifted = cv_mat_image * (1 << 6);
-
+			if(zero_copy){
+				if(slot){
+					ring.lend(slot, image.bp, n_get);
+				}
+			} else {
+				frame_copies++;
+			}
+			long long host_us = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
 
 
             long long current_ts = image.tsSec * 1000000 + image.tsUSec;
@@ -188,60 +368,52 @@ void Ximea::run(){
 
             float fps = 1e6/(diff_us);
 
+			if(last_acq_nframe != 0 && image.acq_nframe > last_acq_nframe + 1){
+				number_of_skipped_frames += image.acq_nframe - last_acq_nframe - 1;
+				skipped_metric.add(image.acq_nframe - last_acq_nframe - 1);
+			}
+			last_acq_nframe = image.acq_nframe;
+			frames_metric.add();
+			fps_metric.set(fps);
+
+
+			FrameLogRecord record;
+			record.frame_id = frame_id;
+			record.slot = slot ? slot->index : FRAME_LOG_NO_SLOT;
+			record.ts_us = current_ts;
+			record.host_us = host_us;
+			record.exposure_us = image.exposure_time_us;
+			record.gain_db = image.gain_db;
+			record.skipped_frames = number_of_skipped_frames;
+			record.reserved = 0;
+			ts_log.append(record);
+			if(clock_sync){
+				clock_sync->add_frame(frame_id, current_ts, image.exposure_time_us, host_us);
+			}
 
-            // float temperature = 0.0;
-            // xiSetParamInt(xiH, XI_PRM_TEMP_SELECTOR, XI_TEMP_IMAGE_SENSOR_DIE_RAW); 
-            // xiGetParamFloat(xiH, XI_PRM_TEMP, &temperature); 
-            // printf("%f\n", temperature);
-
-
-            int number_of_skipped_frames = 0;
-            xiSetParamInt(xiH, XI_PRM_COUNTER_SELECTOR, XI_CNT_SEL_API_SKIPPED_FRAMES);
-            xiGetParamInt(xiH, XI_PRM_COUNTER_VALUE, &number_of_skipped_frames);
+			if(slot){
+				slot->meta.frame_id = frame_id;
+				slot->meta.ts_us = current_ts;
+				slot->meta.exposure_us = image.exposure_time_us;
+				slot->meta.gain_db = image.gain_db;
+				slot->meta.skipped_frames = number_of_skipped_frames;
+				ring.publish(slot);
+			}
+			queue_depth = ring.depth();
+			session_bytes = sink->stats().stored_bytes.load();
 	
 
-			ts_file << std::to_string(frame_id) << ", " 
-					<<  std::to_string(current_ts) << ", " 
-					<< std::to_string(image.exposure_time_us/1000.0) << ", " 
-					<< std::to_string(image.gain_db) << ", " 
-					<< std::to_string(number_of_skipped_frames)					
-					<<std::endl;
 
 			// unsigned char pixel = *(unsigned char*)image.bp;
 			if(frame_id % 64 == 0){
-				printf("\rFrame %d - ts: %d.%ds fps: %f, exposure_us: %f ms, gain %f dB, skipped: %d", 
-            	frame_id, image.tsSec, image.tsUSec, fps, image.exposure_time_us/1000.0, image.gain_db, number_of_skipped_frames);
+				RingStats rs = ring.stats();
+				XimeaHealth health = telemetry->latest();
+				printf("\rFrame %d - ts: %d.%ds fps: %f, exposure_us: %f ms, gain %f dB, skipped: %d, queue: %zu/%zu (max %zu), dropped: %llu, leases: %zu, copies/frame %.2f, ratio %.2f, sensor %.1f C", 
+            	frame_id, image.tsSec, image.tsUSec, fps, image.exposure_time_us/1000.0, image.gain_db, number_of_skipped_frames,
+				rs.depth, rs.capacity, rs.high_water, (unsigned long long)(rs.dropped_oldest + rs.dropped_newest), rs.leases,
+				(double)frame_copies / n_get, sink->stats().ratio(), health.sensor_temp);
 				fflush(stdout);
 			}
-			
-			
-
-            // cv::Mat rgb = cv::Mat(shifted.rows, shifted.cols, CV_16UC3);
-            // cv::cvtColor(shifted, rgb, cv::COLOR_BayerGBRG2BGR);
-
-            //cv::imwrite(filename, shifted);
-            // cv::imshow("view",rgb);
-            // char c = (char)cv::waitKey(1);
-            // if( c == 27 ) 
-            // break;
-
-
-			char filename[100] = "";
-			sprintf(filename, "frame%06d.tif", frame_id);
- 
-
-			fs::path img_path = frames_path / fs::path(filename);
-
-
-			const char* c_img_path = img_path.c_str();
-            
-			WriteImage(shifted, c_img_path);
-
-
-			{
-				std::lock_guard<std::mutex> lock(frame_mutex);
-				out_frame = shifted.clone();
-			}
 
 
 			// Check if recording interrupted
@@ -249,8 +421,9 @@ void Ximea::run(){
 				std::lock_guard<std::mutex> lock(mutex);
 
 				if(stopped || paused){
+					mark_capture_end();
 					xiStopAcquisition(xiH);
-					ts_file.close();
+					ts_log.close();
 					// Stop Aquisition
 
 					break;
@@ -259,8 +432,32 @@ void Ximea::run(){
 			}
 			frame_id++;
 		}
+
+		telemetry->stop();
+
+		// Let the writers drain the ring, the session is only complete once every queued frame is on disk
+		writer.stop();
+		sink->close();
+		print_sink_stats("Ximea", sink->sink_format(), sink->stats());
+		sink.reset();
+		mark_drained();
+
+		RingStats rs = ring.stats();
+		XimeaHealth health = telemetry->latest();
+		printf("\nXimea: %d frames, %llu written, %llu write errors, ring %s high-water %zu/%zu, dropped oldest %llu, dropped newest %llu\n",
+			frame_id + 1, (unsigned long long)writer.frames_written(), (unsigned long long)writer.write_errors(),
+			ring_policy_name(config.ring_policy), rs.high_water, rs.capacity,
+			(unsigned long long)rs.dropped_oldest, (unsigned long long)rs.dropped_newest);
+		if(decimated){
+			printf("Ximea: %llu frames not saved because of storage decimation\n", (unsigned long long)decimated);
+		}
+		queue_depth = 0;
+		printf("Ximea: %.2f frame copies per frame (%s buffers)\n", n_get ? (double)frame_copies / n_get : 0.0, zero_copy ? "unsafe" : "safe");
+		printf("Ximea: %d frame number gaps, API skipped %d, transport skipped %d, sensor %.1f C, board %.1f C\n",
+			number_of_skipped_frames, health.api_skipped, health.transport_skipped, health.sensor_temp, health.board_temp);
 	}
 
+	telemetry.reset();
 	xiCloseDevice(xiH);
 
 }
@@ -270,7 +467,11 @@ void Ximea::run(){
 void Ximea::init() {
 
 	try {
-		CE(xiOpenDevice(0, &xiH));
+		if(config.serial.empty()){
+			CE(xiOpenDevice(0, &xiH));
+		} else {
+			CE(xiOpenDeviceBy(XI_OPEN_BY_SN, config.serial.c_str(), &xiH));
+		}
 
 		xiSetParamInt(xiH, XI_PRM_DEBUG_LEVEL, XI_DL_WARNING);
 		xiSetParamInt(xiH, XI_PRM_DEBUG_LEVEL, XI_DL_DISABLED);
@@ -290,7 +491,18 @@ void Ximea::init() {
 			CE(xiSetParamInt(xiH, XI_PRM_AEAG, XI_OFF));	
 		}
 
-		CE(xiSetParamInt(xiH,XI_PRM_BUFFER_POLICY,XI_BP_SAFE));
+		if(config.unsafe_buffers){
+			CE(xiSetParamInt(xiH,XI_PRM_BUFFER_POLICY,XI_BP_UNSAFE));
+		} else {
+			CE(xiSetParamInt(xiH,XI_PRM_BUFFER_POLICY,XI_BP_SAFE));
+		}
+		if(config.acq_buffer_size_mb > 0){
+			CE(xiSetParamInt(xiH, XI_PRM_ACQ_BUFFER_SIZE, config.acq_buffer_size_mb * 1024 * 1024));
+		}
+		if(config.buffers_queue_size > 0){
+			CE(xiSetParamInt(xiH, XI_PRM_BUFFERS_QUEUE_SIZE, config.buffers_queue_size));
+		}
+		CE(xiGetParamInt(xiH, XI_PRM_BUFFERS_QUEUE_SIZE, &buffers_queue_size));
 		CE(xiSetParamInt(xiH, XI_PRM_ACQ_TIMING_MODE, XI_ACQ_TIMING_MODE_FRAME_RATE));
 		CE(xiSetParamInt(xiH,XI_PRM_FRAMERATE, config.fps));
 
@@ -303,6 +515,9 @@ void Ximea::init() {
 		// CE(xiSetParamInt(xiH, XI_PRM_GPO_MODE,  XI_GPO_OFF));
 		CE(xiSetParamInt(xiH, XI_PRM_GPO_MODE,  XI_GPO_EXPOSURE_ACTIVE));
 
+		CE(xiGetParamInt(xiH, XI_PRM_WIDTH, &width));
+		CE(xiGetParamInt(xiH, XI_PRM_HEIGHT, &height));
+
 
 	}
 	catch (const char* err) {
@@ -0,0 +1,102 @@
+/**********************************************************************************************************************
+ * Copyright (c) 2023 Jakub Mandula.                                                                                       *
+ *                                                                                                                    *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ * software and associated documentation files (the “Software”), to deal in the Software
+ * without restriction, including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ **********************************************************************************************************************/
+
+
+
+#include "ximea_telemetry.hpp"
+
+#include <chrono>
+#include <iostream>
+
+
+void XimeaTelemetry::start(const std::string &csv_path){
+    if(thread.joinable()){
+        return;
+    }
+
+    csv.open(csv_path);
+    csv << "ts_us, api_skipped, transport_skipped, sensor_temp, board_temp" << std::endl;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        health = XimeaHealth();
+        running = true;
+    }
+    thread = std::thread(&XimeaTelemetry::run, this);
+}
+
+
+void XimeaTelemetry::stop(){
+    if(!thread.joinable()){
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wake.notify_all();
+    thread.join();
+
+    // Final sample so the CSV covers the whole session
+    sample();
+    csv.close();
+}
+
+
+XimeaHealth XimeaTelemetry::latest(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return health;
+}
+
+
+void XimeaTelemetry::run(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(running){
+        lock.unlock();
+        sample();
+        lock.lock();
+
+        wake.wait_for(lock, std::chrono::milliseconds(interval_ms), [this]() { return !running; });
+    }
+}
+
+
+void XimeaTelemetry::sample(){
+    XimeaHealth h;
+    h.sample_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    // Selector + value pairs, only this thread touches the selectors
+    if(xiSetParamInt(xiH, XI_PRM_COUNTER_SELECTOR, XI_CNT_SEL_API_SKIPPED_FRAMES) == XI_OK){
+        xiGetParamInt(xiH, XI_PRM_COUNTER_VALUE, &h.api_skipped);
+    }
+    if(xiSetParamInt(xiH, XI_PRM_COUNTER_SELECTOR, XI_CNT_SEL_TRANSPORT_SKIPPED_FRAMES) == XI_OK){
+        xiGetParamInt(xiH, XI_PRM_COUNTER_VALUE, &h.transport_skipped);
+    }
+    if(xiSetParamInt(xiH, XI_PRM_TEMP_SELECTOR, XI_TEMP_IMAGE_SENSOR_DIE) == XI_OK){
+        xiGetParamFloat(xiH, XI_PRM_TEMP, &h.sensor_temp);
+    }
+    if(xiSetParamInt(xiH, XI_PRM_TEMP_SELECTOR, XI_TEMP_SENSOR_BOARD) == XI_OK){
+        xiGetParamFloat(xiH, XI_PRM_TEMP, &h.board_temp);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        health = h;
+    }
+
+    csv << h.sample_us << ", " << h.api_skipped << ", " << h.transport_skipped << ", "
+        << h.sensor_temp << ", " << h.board_temp << "\n";
+    csv.flush();
+}